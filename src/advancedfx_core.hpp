@@ -0,0 +1,3560 @@
+#pragma once
+
+// Platform neutral part of the addon: everything in here only talks to the reshade::api
+// interfaces, the Windows specific glue (DllMain, resource loading, exports) lives in main.cpp.
+
+#include <reshade_api.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <map>
+
+#ifdef _MSC_VER
+#define ADVANCEDFX_UUID(uuid_string) __declspec(uuid(uuid_string))
+#else
+#define ADVANCEDFX_UUID(uuid_string)
+#endif
+
+// Resource ids of the shaders in the ReShade module.
+#define IDR_COPY_PS                     101
+#define IDR_FULLSCREEN_VS               102
+
+// Resource ids of the addon's own shaders.
+#include "resource.h"
+
+struct data_resource
+{
+	size_t data_size;
+	const void* data;
+};
+
+// Implemented by the platform layer.
+data_resource load_data_resource(unsigned short id);
+data_resource load_addon_data_resource(unsigned short id);
+
+using namespace reshade::api;
+
+struct cmp_resource {
+	bool operator()(const resource& a, const resource& b) const {
+		return a.handle < b.handle;
+	}
+};
+
+// Open addressing hash table keyed by resource handle, with a fast path for the entry
+// that was looked up last (usually HLAE renders to the same target as in the last call).
+// Values are stored inline, so pointers returned are only valid until the next emplace.
+template <typename T>
+struct resource_table_s
+{
+	enum slot_state_e : uint8_t {
+		slot_empty = 0,
+		slot_occupied,
+		slot_deleted
+	};
+
+	struct slot_s {
+		resource key = { 0 };
+		T value = {};
+		slot_state_e state = slot_empty;
+	};
+
+	std::vector<slot_s> _slots;
+	size_t _count = 0;
+	size_t _used = 0; // occupied + deleted
+	size_t _last = SIZE_MAX;
+
+	static size_t hash(resource key) {
+		uint64_t h = key.handle;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		return static_cast<size_t>(h);
+	}
+
+	size_t find_slot(resource key) const {
+		if (_last < _slots.size() && _slots[_last].state == slot_occupied && _slots[_last].key == key)
+			return _last;
+		if (_slots.empty())
+			return SIZE_MAX;
+
+		const size_t mask = _slots.size() - 1;
+		for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+			const slot_s& slot = _slots[i];
+			if (slot.state == slot_empty)
+				return SIZE_MAX;
+			if (slot.state == slot_occupied && slot.key == key)
+				return i;
+		}
+	}
+
+	T* find(resource key) {
+		const size_t index = find_slot(key);
+		if (index == SIZE_MAX)
+			return nullptr;
+		_last = index;
+		return &_slots[index].value;
+	}
+
+	T& emplace(resource key) {
+		if (T* value = find(key))
+			return *value;
+
+		if ((_used + 1) * 4 > _slots.size() * 3) {
+			size_t capacity = 16;
+			while (capacity < (_count + 1) * 2)
+				capacity *= 2;
+			rehash(capacity);
+		}
+
+		const size_t mask = _slots.size() - 1;
+		size_t i = hash(key) & mask;
+		while (_slots[i].state == slot_occupied)
+			i = (i + 1) & mask;
+
+		if (_slots[i].state == slot_empty)
+			++_used;
+		++_count;
+
+		_slots[i].key = key;
+		_slots[i].value = {};
+		_slots[i].state = slot_occupied;
+		_last = i;
+		return _slots[i].value;
+	}
+
+	void erase(resource key) {
+		const size_t index = find_slot(key);
+		if (index == SIZE_MAX)
+			return;
+
+		_slots[index].value = {};
+		_slots[index].state = slot_deleted;
+		--_count;
+	}
+
+	void rehash(size_t capacity) {
+		std::vector<slot_s> old_slots(capacity);
+		old_slots.swap(_slots);
+		_used = _count;
+		_last = SIZE_MAX;
+
+		const size_t mask = capacity - 1;
+		for (auto& old_slot : old_slots) {
+			if (old_slot.state != slot_occupied)
+				continue;
+			size_t i = hash(old_slot.key) & mask;
+			while (_slots[i].state != slot_empty)
+				i = (i + 1) & mask;
+			_slots[i].key = old_slot.key;
+			_slots[i].value = std::move(old_slot.value);
+			_slots[i].state = slot_occupied;
+		}
+	}
+
+	template <typename F>
+	void for_each(F&& callback) {
+		for (auto& slot : _slots) {
+			if (slot.state == slot_occupied)
+				callback(slot.key, slot.value);
+		}
+	}
+
+	void clear() {
+		_slots.clear();
+		_count = 0;
+		_used = 0;
+		_last = SIZE_MAX;
+	}
+};
+
+// Textures and views the addon dropped while frames using them may still be in flight (D3D12 and
+// Vulkan don't track that). They are tagged with the value the frame fence gets signaled with at the
+// end of the next render_effects call and destroyed once the GPU passed it. Without fence support
+// they are destroyed right away, as before.
+struct retirement_queue_s
+{
+	struct entry_s {
+		resource texture;
+		resource_view view;
+		uint64_t fence_value;
+	};
+
+	std::vector<entry_s> _entries;
+	fence _fence = { 0 };
+	uint64_t _fence_value = 0; // Last value signaled.
+	bool _fence_failed = false;
+
+	bool ensure_fence(device* device) {
+		if (_fence == 0 && !_fence_failed)
+			_fence_failed = !device->create_fence(0, fence_flags::none, &_fence);
+		return _fence != 0;
+	}
+
+	void retire(device* device, resource texture) {
+		if (ensure_fence(device))
+			_entries.push_back({ texture, { 0 }, _fence_value + 1 });
+		else
+			device->destroy_resource(texture);
+	}
+
+	void retire(device* device, resource_view view) {
+		if (ensure_fence(device))
+			_entries.push_back({ { 0 }, view, _fence_value + 1 });
+		else
+			device->destroy_resource_view(view);
+	}
+
+	// Destroys what the GPU is done with, without waiting for it.
+	void collect(device* device) {
+		if (_entries.empty())
+			return;
+
+		const uint64_t completed = device->get_completed_fence_value(_fence);
+		size_t kept = 0;
+		for (const auto& entry : _entries) {
+			if (entry.fence_value > completed)
+				_entries[kept++] = entry;
+			else
+				destroy(device, entry);
+		}
+		_entries.resize(kept);
+	}
+
+	// Views on a texture the game destroys can't wait: they must not outlive it, and the game has waited
+	// for the GPU to be done with it already.
+	void destroy_views_of(device* device, resource texture) {
+		size_t kept = 0;
+		for (const auto& entry : _entries) {
+			if (entry.view != 0 && device->get_resource_from_view(entry.view) == texture)
+				device->destroy_resource_view(entry.view);
+			else
+				_entries[kept++] = entry;
+		}
+		_entries.resize(kept);
+	}
+
+	// Submits the work recorded so far and signals the frame fence, if anything is waiting for it.
+	void signal(command_queue* command_queue) {
+		if (_entries.empty() || _entries.back().fence_value <= _fence_value)
+			return;
+
+		command_queue->flush_immediate_command_list();
+		command_queue->signal(_fence, ++_fence_value);
+	}
+
+	// The device is idle when it is destroyed.
+	void clear(device* device) {
+		for (const auto& entry : _entries)
+			destroy(device, entry);
+		_entries.clear();
+		if (_fence != 0) {
+			device->destroy_fence(_fence);
+			_fence = { 0 };
+		}
+		_fence_value = 0;
+	}
+
+	static void destroy(device* device, const entry_s& entry) {
+		if (entry.view != 0)
+			device->destroy_resource_view(entry.view);
+		if (entry.texture != 0)
+			device->destroy_resource(entry.texture);
+	}
+};
+
+// Recycles intermediate textures (resolve targets, depth copies), so that switching
+// between streams / resolutions does not cause a create / destroy storm.
+// Free textures are kept around until the pool exceeds its budget, then the least
+// recently used ones are evicted first.
+struct texture_pool_s
+{
+	struct key_s {
+		uint32_t width;
+		uint32_t height;
+		reshade::api::format format;
+		uint16_t samples;
+		resource_usage usage;
+		memory_heap heap = memory_heap::gpu_only;
+		uint16_t levels = 1;
+
+		bool operator==(const key_s& other) const {
+			return width == other.width
+				&& height == other.height
+				&& format == other.format
+				&& samples == other.samples
+				&& usage == other.usage
+				&& heap == other.heap
+				&& levels == other.levels;
+		}
+	};
+
+	struct entry_s {
+		key_s key;
+		resource texture;
+		resource_usage state;
+		uint64_t size;
+		uint64_t last_used;
+	};
+
+	uint64_t _budget = 512ull << 20;
+	uint64_t _clock = 0;
+	uint64_t _in_use_size = 0;
+	uint64_t _pooled_size = 0;
+	uint64_t _hits = 0;
+	uint64_t _misses = 0;
+	uint64_t _evictions = 0;
+
+	std::vector<entry_s> _free;
+	std::map<resource, entry_s, cmp_resource> _in_use;
+	// Evicted textures and the views on pooled textures are destroyed through this.
+	retirement_queue_s _retired;
+
+	void retire_view(device* device, resource_view view) {
+		_retired.retire(device, view);
+	}
+
+	static uint64_t get_texture_size(const key_s& key) {
+		uint64_t size = 0;
+		for (uint32_t level = 0; level < key.levels; ++level) {
+			const uint32_t width = std::max(1u, key.width >> level);
+			const uint32_t height = std::max(1u, key.height >> level);
+			size += static_cast<uint64_t>(format_slice_pitch(key.format, format_row_pitch(key.format, width), height)) * key.samples;
+		}
+		return size;
+	}
+
+	// Hands out a texture matching key, state receives the state the texture currently is in.
+	bool acquire(device* device, const key_s& key, resource_usage initial_state, const char* name, resource* out_texture, resource_usage* out_state) {
+		++_clock;
+
+		auto best = _free.end();
+		for (auto it = _free.begin(); it != _free.end(); ++it) {
+			if (it->key == key && (best == _free.end() || best->last_used < it->last_used))
+				best = it;
+		}
+
+		if (best != _free.end()) {
+			entry_s entry = *best;
+			_free.erase(best);
+			_pooled_size -= entry.size;
+
+			entry.last_used = _clock;
+			_in_use_size += entry.size;
+			_in_use.emplace(entry.texture, entry);
+			++_hits;
+
+			*out_texture = entry.texture;
+			*out_state = entry.state;
+			return true;
+		}
+
+		++_misses;
+
+		resource texture = { 0 };
+		if (!device->create_resource(
+			resource_desc(key.width, key.height, 1, key.levels, key.format, key.samples, key.heap, key.usage),
+			nullptr, initial_state, &texture))
+			return false;
+
+		if (name)
+			device->set_resource_name(texture, name);
+
+		const entry_s entry = { key, texture, initial_state, get_texture_size(key), _clock };
+		_in_use_size += entry.size;
+		_in_use.emplace(texture, entry);
+
+		trim(device);
+
+		*out_texture = texture;
+		*out_state = initial_state;
+		return true;
+	}
+
+	// Takes back a texture previously handed out by acquire, state is the state it was left in.
+	void release(device* device, resource texture, resource_usage state) {
+		auto it = _in_use.find(texture);
+		if (it == _in_use.end())
+			return;
+
+		entry_s entry = it->second;
+		_in_use.erase(it);
+		_in_use_size -= entry.size;
+
+		entry.state = state;
+		entry.last_used = ++_clock;
+		_pooled_size += entry.size;
+		_free.push_back(entry);
+
+		trim(device);
+	}
+
+	void trim(device* device) {
+		while (!_free.empty() && _budget < _in_use_size + _pooled_size) {
+			auto oldest = _free.begin();
+			for (auto it = _free.begin(); it != _free.end(); ++it) {
+				if (it->last_used < oldest->last_used)
+					oldest = it;
+			}
+
+			const entry_s entry = *oldest;
+			_free.erase(oldest);
+			_pooled_size -= entry.size;
+			++_evictions;
+
+			_retired.retire(device, entry.texture);
+		}
+	}
+
+	void set_budget(device* device, uint64_t budget) {
+		_budget = budget;
+		trim(device);
+	}
+
+	void clear(device* device) {
+		// First, retired views may be on the pooled textures.
+		_retired.clear(device);
+
+		for (const auto& entry : _free)
+			device->destroy_resource(entry.texture);
+		_free.clear();
+		_pooled_size = 0;
+
+		for (const auto& it : _in_use)
+			device->destroy_resource(it.second.texture);
+		_in_use.clear();
+		_in_use_size = 0;
+	}
+};
+
+
+// Knows the current state of each resource the addon touches, skips transitions that
+// are no-ops and issues all transitions queued for a stage with a single barrier call.
+struct resource_state_tracker_s
+{
+	resource_table_s<resource_usage> _states;
+
+	std::vector<resource> _pending_resources;
+	std::vector<resource_usage> _pending_old_states;
+	std::vector<resource_usage> _pending_new_states;
+
+	void set_state(resource resource, resource_usage state) {
+		_states.emplace(resource) = state;
+	}
+
+	// Like set_state, but keeps the current state if the resource is already tracked.
+	void track(resource resource, resource_usage state) {
+		if (_states.find(resource) == nullptr)
+			_states.emplace(resource) = state;
+	}
+
+	resource_usage get_state(resource resource) {
+		const resource_usage* state = _states.find(resource);
+		return state != nullptr ? *state : resource_usage::undefined;
+	}
+
+	void forget(resource resource) {
+		_states.erase(resource);
+	}
+
+	void transition(resource resource, resource_usage new_state) {
+		resource_usage* state = _states.find(resource);
+		if (state == nullptr || *state == new_state)
+			return;
+		const resource_usage old_state = *state;
+		*state = new_state;
+
+		for (size_t i = 0; i < _pending_resources.size(); ++i) {
+			if (_pending_resources[i] == resource) {
+				_pending_new_states[i] = new_state;
+				return;
+			}
+		}
+
+		_pending_resources.push_back(resource);
+		_pending_old_states.push_back(old_state);
+		_pending_new_states.push_back(new_state);
+	}
+
+	void flush(command_list* command_list) {
+		size_t count = 0;
+		for (size_t i = 0; i < _pending_resources.size(); ++i) {
+			// Drop transitions that ended up where they started.
+			if (_pending_old_states[i] == _pending_new_states[i])
+				continue;
+			_pending_resources[count] = _pending_resources[i];
+			_pending_old_states[count] = _pending_old_states[i];
+			_pending_new_states[count] = _pending_new_states[i];
+			++count;
+		}
+
+		if (count != 0)
+			command_list->barrier(static_cast<uint32_t>(count), _pending_resources.data(), _pending_old_states.data(), _pending_new_states.data());
+
+		_pending_resources.clear();
+		_pending_old_states.clear();
+		_pending_new_states.clear();
+	}
+};
+
+// CPU and GPU time spent in each stage of render_effects, for the last history_size calls.
+// A call can go through a stage more than once (batches), times are summed up per stage.
+// Written from the render thread only, the history can be read from any thread.
+struct render_stats_s
+{
+	enum stage_e {
+		stage_resolve = 0, // MSAA resolve or format conversion copy
+		stage_depth, // depth copy
+		stage_effects, // runtime->render_effects
+		stage_write_back, // fullscreen draw / copy back into the back buffer
+		stage_count
+	};
+
+	static constexpr uint32_t history_size = 256;
+	static constexpr uint32_t frames_in_flight = 4;
+	static constexpr uint32_t timestamps_per_frame = 64;
+
+	struct frame_s {
+		uint64_t cpu_ns[stage_count];
+		uint64_t gpu_ns[stage_count];
+		bool has_gpu;
+	};
+
+	// Seqlock: sequence is odd while the slot is being written.
+	struct slot_s {
+		std::atomic<uint32_t> sequence = { 0 };
+		std::atomic<uint64_t> cpu_ns[stage_count] = {};
+		std::atomic<uint64_t> gpu_ns[stage_count] = {};
+		std::atomic<bool> has_gpu = { false };
+	};
+
+	struct pending_s {
+		bool active = false;
+		frame_s frame;
+		uint32_t timestamp_count;
+		stage_e stages[timestamps_per_frame]; // stage that ended with the timestamp
+	};
+
+	// Off unless ADVANCEDFX/CollectStats=1, the timestamp queries cost GPU time on every call.
+	bool _enabled = false;
+	slot_s _history[history_size];
+	std::atomic<uint64_t> _history_count = { 0 };
+
+	query_heap _query_heap = { 0 };
+	bool _query_heap_failed = false;
+	uint64_t _timestamp_frequency = 0;
+	pending_s _pending[frames_in_flight];
+	uint32_t _next_pending = 0;
+
+	uint32_t _current = 0;
+	pending_s _frame = {};
+	std::chrono::steady_clock::time_point _stage_start;
+
+	void push(const frame_s& frame) {
+		const uint64_t index = _history_count.load(std::memory_order_relaxed);
+		slot_s& slot = _history[index % history_size];
+
+		slot.sequence.fetch_add(1, std::memory_order_acquire);
+		for (uint32_t i = 0; i < stage_count; ++i) {
+			slot.cpu_ns[i].store(frame.cpu_ns[i], std::memory_order_relaxed);
+			slot.gpu_ns[i].store(frame.gpu_ns[i], std::memory_order_relaxed);
+		}
+		slot.has_gpu.store(frame.has_gpu, std::memory_order_relaxed);
+		slot.sequence.fetch_add(1, std::memory_order_release);
+
+		_history_count.store(index + 1, std::memory_order_release);
+	}
+
+	// Copies the frames currently in the history, skipping slots that are being overwritten.
+	void read_history(std::vector<frame_s>& out_frames) const {
+		const uint64_t count = std::min<uint64_t>(_history_count.load(std::memory_order_acquire), history_size);
+		out_frames.clear();
+		out_frames.reserve(static_cast<size_t>(count));
+
+		for (uint64_t i = 0; i < count; ++i) {
+			const slot_s& slot = _history[i];
+			const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if (sequence & 1)
+				continue;
+
+			frame_s frame;
+			for (uint32_t j = 0; j < stage_count; ++j) {
+				frame.cpu_ns[j] = slot.cpu_ns[j].load(std::memory_order_relaxed);
+				frame.gpu_ns[j] = slot.gpu_ns[j].load(std::memory_order_relaxed);
+			}
+			frame.has_gpu = slot.has_gpu.load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+				out_frames.push_back(frame);
+		}
+	}
+
+	// Pushes pending frames whose timestamps are available, if force is set frames
+	// that are not ready yet are pushed without GPU times.
+	void collect(device* device, uint32_t index, bool force) {
+		pending_s& pending = _pending[index];
+		if (!pending.active)
+			return;
+
+		uint64_t timestamps[timestamps_per_frame];
+		if (pending.timestamp_count == 0) {
+			// Ran out of timestamps, only CPU times are available.
+		}
+		else if (device->get_query_heap_results(_query_heap, index * timestamps_per_frame, pending.timestamp_count, timestamps, sizeof(uint64_t))) {
+			for (uint32_t i = 1; i < pending.timestamp_count; ++i) {
+				if (timestamps[i] > timestamps[i - 1])
+					pending.frame.gpu_ns[pending.stages[i]] += (timestamps[i] - timestamps[i - 1]) * 1000000000ull / _timestamp_frequency;
+			}
+			pending.frame.has_gpu = true;
+		}
+		else if (!force) {
+			return;
+		}
+
+		push(pending.frame);
+		pending.active = false;
+	}
+
+	void begin_frame(device* device, command_queue* command_queue, command_list* command_list) {
+		if (!_enabled)
+			return;
+
+		if (_query_heap == 0 && !_query_heap_failed) {
+			_timestamp_frequency = command_queue->get_timestamp_frequency();
+			_query_heap_failed = _timestamp_frequency == 0
+				|| !device->create_query_heap(query_type::timestamp, frames_in_flight * timestamps_per_frame, &_query_heap);
+		}
+
+		if (_query_heap != 0) {
+			// Oldest first, the slot about to be reused can't wait any longer.
+			for (uint32_t i = 0; i < frames_in_flight; ++i) {
+				const uint32_t index = (_next_pending + i) % frames_in_flight;
+				collect(device, index, i == 0);
+				if (_pending[index].active)
+					break;
+			}
+		}
+
+		_current = _next_pending;
+		_next_pending = (_next_pending + 1) % frames_in_flight;
+
+		_frame.active = true;
+		_frame.frame = {};
+		_frame.timestamp_count = 0;
+		_stage_start = std::chrono::steady_clock::now();
+		if (_query_heap != 0)
+			command_list->end_query(_query_heap, query_type::timestamp, _current * timestamps_per_frame + _frame.timestamp_count++);
+	}
+
+	void end_stage(command_list* command_list, stage_e stage) {
+		if (!_enabled)
+			return;
+
+		const auto now = std::chrono::steady_clock::now();
+		_frame.frame.cpu_ns[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - _stage_start).count();
+		_stage_start = now;
+
+		if (_query_heap != 0 && _frame.timestamp_count != 0) {
+			if (_frame.timestamp_count < timestamps_per_frame) {
+				_frame.stages[_frame.timestamp_count] = stage;
+				command_list->end_query(_query_heap, query_type::timestamp, _current * timestamps_per_frame + _frame.timestamp_count++);
+			}
+			else {
+				_frame.timestamp_count = 0;
+			}
+		}
+	}
+
+	void end_frame() {
+		if (!_enabled)
+			return;
+
+		if (_query_heap != 0)
+			_pending[_current] = _frame;
+		else
+			push(_frame.frame);
+	}
+
+	void on_destroy_device(device* device) {
+		if (_query_heap != 0) {
+			for (uint32_t i = 0; i < frames_in_flight; ++i)
+				_pending[i].active = false;
+			device->destroy_query_heap(_query_heap);
+			_query_heap = { 0 };
+		}
+		_query_heap_failed = false;
+	}
+
+	struct summary_s {
+		uint64_t min_ns;
+		uint64_t avg_ns;
+		uint64_t p99_ns;
+	};
+
+	static summary_s summarize(std::vector<uint64_t>& values) {
+		if (values.empty())
+			return { 0, 0, 0 };
+
+		std::sort(values.begin(), values.end());
+
+		uint64_t sum = 0;
+		for (const uint64_t value : values)
+			sum += value;
+
+		const size_t p99_index = (values.size() * 99 + 99) / 100 - 1;
+		return { values.front(), sum / values.size(), values[std::min(p99_index, values.size() - 1)] };
+	}
+};
+
+// Uniform variables annotated with one of the sources the addon provides, collected
+// once per effect reload so updates don't have to walk all uniforms of all effects.
+struct uniform_source_index_s
+{
+	enum source_e {
+		source_bufready_depth = 0,
+		source_depth_near_plane,
+		source_depth_far_plane,
+		source_camera_fov,
+		source_camera_near_plane,
+		source_camera_far_plane,
+		source_camera_origin,
+		source_camera_angles,
+		source_camera_view,
+		source_camera_projection,
+		source_demo_time,
+		source_count
+	};
+
+	static constexpr const char* source_names[source_count] = {
+		"bufready_depth",
+		"depth_near_plane",
+		"depth_far_plane",
+		"camera_fov",
+		"camera_near_plane",
+		"camera_far_plane",
+		"camera_origin",
+		"camera_angles",
+		"camera_view",
+		"camera_projection",
+		"demo_time"
+	};
+
+	std::vector<effect_uniform_variable> _variables[source_count];
+	bool _valid = false;
+
+	void rebuild(effect_runtime* runtime) {
+		for (auto& variables : _variables)
+			variables.clear();
+
+		runtime->enumerate_uniform_variables(nullptr, [this](effect_runtime* runtime, effect_uniform_variable variable) {
+			char source[32] = "";
+			if (!runtime->get_annotation_string_from_uniform_variable(variable, "source", source))
+				return;
+			for (int i = 0; i < source_count; ++i) {
+				if (std::strcmp(source, source_names[i]) == 0) {
+					_variables[i].push_back(variable);
+					break;
+				}
+			}
+			});
+
+		_valid = true;
+	}
+
+	const std::vector<effect_uniform_variable>& get(effect_runtime* runtime, source_e source) {
+		if (!_valid)
+			rebuild(runtime);
+		return _variables[source];
+	}
+};
+
+// Camera of the frame HLAE renders, written to the uniforms with the matching camera_* / demo_time
+// source. Matrices are row by row.
+struct camera_uniforms_s
+{
+	float fov; // Horizontal, in degrees.
+	float near_plane;
+	float far_plane;
+	float origin[3];
+	float angles[3]; // Pitch, yaw, roll in degrees.
+	float view[16];
+	float projection[16];
+	float demo_time; // In seconds.
+};
+
+// Techniques of a runtime with their handles and names, built once per reload, so HLAE can pick the
+// effect set per call with a mask instead of switching presets, which recompiles all effects.
+// Only techniques whose state differs from what was set last are switched.
+struct technique_table_s
+{
+	static constexpr size_t max_masked = 64; // Techniques past this keep the user's state.
+
+	struct entry_s {
+		effect_technique technique;
+		std::string name;
+		bool user_enabled; // State picked by the user, restored by unmasked calls.
+		bool enabled;      // State set last.
+		bool masked;
+	};
+
+	std::vector<entry_s> _entries;
+	bool _valid = false;
+
+	void rebuild(effect_runtime* runtime) {
+		_entries.clear();
+
+		runtime->enumerate_techniques(nullptr, [this](effect_runtime* runtime, effect_technique technique) {
+			char name[128] = "";
+			runtime->get_technique_name(technique, name);
+			const bool enabled = runtime->get_technique_state(technique);
+			_entries.push_back({ technique, name, enabled, enabled, false });
+			});
+
+		_valid = true;
+	}
+
+	const std::vector<entry_s>& get(effect_runtime* runtime) {
+		if (!_valid)
+			rebuild(runtime);
+		return _entries;
+	}
+
+	// Bit i switches technique i on.
+	void apply_mask(effect_runtime* runtime, uint64_t mask) {
+		if (!_valid)
+			rebuild(runtime);
+
+		const size_t count = std::min(_entries.size(), max_masked);
+		for (size_t i = 0; i < count; ++i) {
+			auto& entry = _entries[i];
+			// The user may have toggled it since the last masked call.
+			if (!entry.masked)
+				entry.user_enabled = entry.enabled = runtime->get_technique_state(entry.technique);
+			set_state(runtime, entry, ((mask >> i) & 1) != 0);
+			entry.masked = true;
+		}
+	}
+
+	void restore(effect_runtime* runtime) {
+		for (auto& entry : _entries) {
+			if (!entry.masked)
+				continue;
+			set_state(runtime, entry, entry.user_enabled);
+			entry.masked = false;
+		}
+	}
+
+	static void set_state(effect_runtime* runtime, entry_s& entry, bool enabled) {
+		if (entry.enabled == enabled)
+			return;
+		runtime->set_technique_state(entry.technique, enabled);
+		entry.enabled = enabled;
+	}
+};
+
+// Creates the addon's pipelines on first use, so devices HLAE never renders through don't pay for
+// them. Each variant is built once, failures are remembered so they aren't retried every call.
+struct pipeline_cache_s
+{
+	enum kind_e : uint32_t {
+		kind_copy = 0,
+		kind_depth_resolve,
+		kind_linear_depth,
+		kind_depth_min_max,
+		kind_count
+	};
+
+	struct key_s {
+		kind_e kind;
+		reshade::api::format target_format;
+		uint16_t samples;
+		bool srgb;
+
+		bool operator==(const key_s& other) const {
+			return kind == other.kind
+				&& target_format == other.target_format
+				&& samples == other.samples
+				&& srgb == other.srgb;
+		}
+	};
+
+	struct entry_s {
+		key_s key;
+		reshade::api::pipeline pipeline;
+	};
+
+	std::vector<entry_s> _entries;
+	pipeline_layout _layouts[kind_count] = {};
+	bool _layout_failed[kind_count] = {};
+	sampler _samplers[2] = {}; // point, linear
+	bool _sampler_failed[2] = {};
+
+	static bool is_supported(device* device, kind_e kind) {
+		switch (device->get_api()) {
+		case device_api::d3d10:
+		case device_api::d3d11:
+			return true;
+		case device_api::d3d12:
+			// The depth pyramid needs per subresource states, see render_linear_depth.
+			return kind == kind_copy || kind == kind_depth_resolve;
+		}
+		return false;
+	}
+
+	pipeline_layout get_layout(device* device, kind_e kind) {
+		if (_layouts[kind] != 0 || _layout_failed[kind])
+			return _layouts[kind];
+
+		constant_range constants = {};
+		constants.count = kind == kind_linear_depth ? 2 : 1;
+		constants.visibility = shader_stage::pixel;
+
+		uint32_t param_count = 0;
+		pipeline_layout_param layout_params[2];
+		switch (kind) {
+		case kind_copy:
+			layout_params[param_count++] = descriptor_range{ 0, 0, 0, 1, shader_stage::all, 1, descriptor_type::sampler };
+			break;
+		case kind_depth_resolve:
+		case kind_linear_depth:
+			layout_params[param_count++] = constants;
+			break;
+		}
+		layout_params[param_count++] = descriptor_range{ 0, 0, 0, 1, shader_stage::all, 1, descriptor_type::shader_resource_view };
+
+		_layout_failed[kind] = !device->create_pipeline_layout(param_count, layout_params, &_layouts[kind]);
+		return _layouts[kind];
+	}
+
+	// Returns 0 if the variant can't be created on this device.
+	pipeline get(device* device, const key_s& key) {
+		for (const auto& entry : _entries) {
+			if (entry.key == key)
+				return entry.pipeline;
+		}
+
+		pipeline result = { 0 };
+		const pipeline_layout layout = is_supported(device, key.kind) ? get_layout(device, key.kind) : pipeline_layout{ 0 };
+		if (layout != 0) {
+			const data_resource vs = load_data_resource(IDR_FULLSCREEN_VS);
+			data_resource ps = {};
+			switch (key.kind) {
+			case kind_copy:
+				ps = load_data_resource(IDR_COPY_PS);
+				break;
+			case kind_depth_resolve:
+				ps = load_addon_data_resource(IDR_DEPTH_RESOLVE_PS);
+				break;
+			case kind_linear_depth:
+				ps = load_addon_data_resource(IDR_LINEARIZE_DEPTH_PS);
+				break;
+			case kind_depth_min_max:
+				ps = load_addon_data_resource(IDR_DEPTH_MIN_MAX_PS);
+				break;
+			}
+
+			shader_desc vs_desc = { vs.data, vs.data_size };
+			shader_desc ps_desc = { ps.data, ps.data_size };
+
+			// The linear depth pass writes DEPTH_LINEAR and level 0 of DEPTH_MIPS at once.
+			format target_formats[2] = { key.target_format, format::r32g32_float };
+			const uint32_t target_count = key.kind == kind_linear_depth ? 2 : 1;
+			uint32_t samples = key.samples;
+
+			const pipeline_subobject subobjects[] = {
+				{ pipeline_subobject_type::vertex_shader, 1, &vs_desc },
+				{ pipeline_subobject_type::pixel_shader, 1, &ps_desc },
+				{ pipeline_subobject_type::render_target_formats, target_count, target_formats },
+				{ pipeline_subobject_type::sample_count, 1, &samples } };
+
+			if (!device->create_pipeline(layout, static_cast<uint32_t>(std::size(subobjects)), subobjects, &result))
+				result = { 0 };
+		}
+
+		_entries.push_back({ key, result });
+		return result;
+	}
+
+	sampler get_sampler(device* device, bool linear) {
+		if (_samplers[linear] != 0 || _sampler_failed[linear])
+			return _samplers[linear];
+
+		sampler_desc sampler_desc = {};
+		sampler_desc.filter = linear ? filter_mode::min_mag_mip_linear : filter_mode::min_mag_mip_point;
+		sampler_desc.address_u = texture_address_mode::clamp;
+		sampler_desc.address_v = texture_address_mode::clamp;
+		sampler_desc.address_w = texture_address_mode::clamp;
+
+		_sampler_failed[linear] = !device->create_sampler(sampler_desc, &_samplers[linear]);
+		return _samplers[linear];
+	}
+
+	void clear(device* device) {
+		for (const auto& entry : _entries) {
+			if (entry.pipeline != 0)
+				device->destroy_pipeline(entry.pipeline);
+		}
+		_entries.clear();
+
+		for (uint32_t kind = 0; kind < kind_count; ++kind) {
+			if (_layouts[kind] != 0)
+				device->destroy_pipeline_layout(_layouts[kind]);
+			_layouts[kind] = {};
+			_layout_failed[kind] = false;
+		}
+
+		for (int linear = 0; linear < 2; ++linear) {
+			if (_samplers[linear] != 0)
+				device->destroy_sampler(_samplers[linear]);
+			_samplers[linear] = {};
+			_sampler_failed[linear] = false;
+		}
+	}
+};
+
+typedef void (*readback_callback_t)(void* user_data, uint64_t frame, const void* data, uint32_t row_pitch, uint32_t width, uint32_t height, uint32_t format);
+
+// Ring of staging textures the processed target is copied into. The copy made in call K is
+// only mapped in call K + N (or when the ring is drained), so the CPU doesn't wait for the GPU.
+struct readback_ring_s
+{
+	struct slot_s {
+		resource staging = { 0 };
+		uint32_t width = 0;
+		uint32_t height = 0;
+		format staging_format = format::unknown;
+		format data_format = format::unknown;
+		uint64_t frame = 0;
+		uint64_t fence_value = 0;
+		bool pending = false;
+	};
+
+	readback_callback_t _callback = nullptr;
+	void* _user_data = nullptr;
+	std::vector<slot_s> _slots;
+	uint32_t _next = 0;
+	uint64_t _frame = 0;
+
+	void deliver(device* device, fence fence, slot_s& slot) {
+		if (!slot.pending)
+			return;
+		slot.pending = false;
+
+		if (fence != 0 && device->get_completed_fence_value(fence) < slot.fence_value)
+			device->wait(fence, slot.fence_value, UINT64_MAX);
+
+		subresource_data data;
+		if (device->map_texture_region(slot.staging, 0, nullptr, map_access::read_only, &data)) {
+			_callback(_user_data, slot.frame, data.data, data.row_pitch, slot.width, slot.height, static_cast<uint32_t>(slot.data_format));
+			device->unmap_texture_region(slot.staging, 0);
+		}
+	}
+
+	// Delivers all outstanding frames, oldest first.
+	void drain(device* device, fence fence) {
+		const size_t count = _slots.size();
+		for (size_t i = 0; i < count; ++i)
+			deliver(device, fence, _slots[(_next + i) % count]);
+	}
+
+	// Returns the slot the next copy goes into, after delivering what it held.
+	slot_s* prepare_slot(device* device, fence fence, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states, uint32_t width, uint32_t height, format staging_format, format data_format) {
+		slot_s& slot = _slots[_next];
+		deliver(device, fence, slot);
+
+		if (slot.staging != 0 && (slot.width != width || slot.height != height || slot.staging_format != staging_format)) {
+			texture_pool.release(device, slot.staging, resource_states.get_state(slot.staging));
+			resource_states.forget(slot.staging);
+			slot.staging = { 0 };
+		}
+
+		if (slot.staging == 0) {
+			texture_pool_s::key_s key = { width, height, staging_format, 1, resource_usage::copy_dest };
+			key.heap = memory_heap::gpu_to_cpu;
+
+			resource_usage state;
+			if (!texture_pool.acquire(device, key, resource_usage::copy_dest, "ReShade advancedfx readback texture", &slot.staging, &state))
+				return nullptr;
+			resource_states.set_state(slot.staging, state);
+		}
+
+		slot.width = width;
+		slot.height = height;
+		slot.staging_format = staging_format;
+		slot.data_format = data_format;
+		return &slot;
+	}
+
+	void commit_slot(uint64_t fence_value) {
+		slot_s& slot = _slots[_next];
+		slot.pending = true;
+		slot.frame = _frame++;
+		slot.fence_value = fence_value;
+		_next = (_next + 1) % static_cast<uint32_t>(_slots.size());
+	}
+
+	void free(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+		for (auto& slot : _slots) {
+			if (slot.staging != 0) {
+				texture_pool.release(device, slot.staging, resource_states.get_state(slot.staging));
+				resource_states.forget(slot.staging);
+			}
+		}
+		_slots.clear();
+		_callback = nullptr;
+		_user_data = nullptr;
+	}
+};
+
+// Compact binary log of HLAE's calls, so that a user's sequence of targets, depth buffers, resizes
+// and destroys can be replayed against another build. Little endian, "AFXT" and the version, then
+// records of a u8 type, the u64 time in ns since the start of the trace and the payload.
+struct trace_format_s
+{
+	static constexpr uint32_t magic = 0x54584641; // "AFXT"
+	static constexpr uint32_t version = 2;
+
+	enum record_e : uint8_t {
+		record_resource = 1, // u32 id, u32 width, u32 height, u16 levels, u32 format, u16 samples, u32 usage
+		record_render,       // u32 count, count * (u32 back buffer id, u32 back buffer state, u32 depth id or 0), u64 duration in ns
+		record_destroy,      // u32 id, the time is when the game destroyed it
+		record_readback      // u32 id, u32 ring size (0 = off)
+	};
+};
+
+// Resource handles are written as ids in order of first use, the desc is written with the first use.
+struct trace_writer_s
+{
+	// A back buffer's state is the one it was handed in and back in, undefined if the call failed for it.
+	struct entry_s {
+		resource back_buffer_resource;
+		resource_usage back_buffer_state;
+		resource depth_buffer_resource;
+	};
+
+	std::FILE* _file = nullptr;
+	std::vector<uint8_t> _buffer;
+	resource_table_s<uint32_t> _ids;
+	uint32_t _next_id = 1;
+	std::chrono::steady_clock::time_point _start;
+
+	bool is_active() const {
+		return _file != nullptr;
+	}
+
+	bool start(const char* path) {
+		stop();
+		_file = std::fopen(path, "wb");
+		if (_file == nullptr)
+			return false;
+
+		_start = std::chrono::steady_clock::now();
+		put<uint32_t>(trace_format_s::magic);
+		put<uint32_t>(trace_format_s::version);
+		return true;
+	}
+
+	void stop() {
+		if (_file == nullptr)
+			return;
+		flush();
+		std::fclose(_file);
+		_file = nullptr;
+		_ids.clear();
+		_next_id = 1;
+	}
+
+	uint64_t now() const {
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count());
+	}
+
+	template <typename T>
+	void put(T value) {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+		_buffer.insert(_buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	void begin_record(trace_format_s::record_e type, uint64_t time) {
+		put<uint8_t>(type);
+		put<uint64_t>(time);
+	}
+
+	void flush() {
+		if (!_buffer.empty())
+			std::fwrite(_buffer.data(), 1, _buffer.size(), _file);
+		_buffer.clear();
+		std::fflush(_file);
+	}
+
+	void end_record() {
+		if (_buffer.size() >= (64u << 10))
+			flush();
+	}
+
+	uint32_t get_id(device* device, resource resource) {
+		if (resource == 0)
+			return 0;
+		if (auto id = _ids.find(resource))
+			return *id;
+
+		const uint32_t id = _next_id++;
+		_ids.emplace(resource) = id;
+
+		const resource_desc desc = device->get_resource_desc(resource);
+		begin_record(trace_format_s::record_resource, now());
+		put<uint32_t>(id);
+		put<uint32_t>(desc.texture.width);
+		put<uint32_t>(desc.texture.height);
+		put<uint16_t>(desc.texture.levels);
+		put<uint32_t>(static_cast<uint32_t>(desc.texture.format));
+		put<uint16_t>(desc.texture.samples);
+		put<uint32_t>(static_cast<uint32_t>(desc.usage));
+		end_record();
+		return id;
+	}
+
+	void write_render(device* device, const entry_s* entries, size_t count, uint64_t time, uint64_t duration) {
+		for (size_t i = 0; i < count; ++i) {
+			get_id(device, entries[i].back_buffer_resource);
+			get_id(device, entries[i].depth_buffer_resource);
+		}
+
+		begin_record(trace_format_s::record_render, time);
+		put<uint32_t>(static_cast<uint32_t>(count));
+		for (size_t i = 0; i < count; ++i) {
+			put<uint32_t>(get_id(device, entries[i].back_buffer_resource));
+			put<uint32_t>(static_cast<uint32_t>(entries[i].back_buffer_state));
+			put<uint32_t>(get_id(device, entries[i].depth_buffer_resource));
+		}
+		put<uint64_t>(duration);
+		end_record();
+	}
+
+	void write_readback(device* device, resource back_buffer_resource, uint32_t ring_size) {
+		const uint32_t id = get_id(device, back_buffer_resource);
+		begin_record(trace_format_s::record_readback, now());
+		put<uint32_t>(id);
+		put<uint32_t>(ring_size);
+		end_record();
+	}
+
+	// Only resources that were part of the trace are logged, time is when the destroy event ran.
+	void write_destroy(resource resource, std::chrono::steady_clock::time_point time) {
+		auto id = _ids.find(resource);
+		if (id == nullptr)
+			return;
+
+		begin_record(trace_format_s::record_destroy, time > _start ? static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time - _start).count()) : 0);
+		put<uint32_t>(*id);
+		end_record();
+		_ids.erase(resource);
+	}
+};
+
+struct trace_reader_s
+{
+	std::vector<uint8_t> _data;
+	size_t _pos = 0;
+
+	bool open(const char* path) {
+		std::FILE* file = std::fopen(path, "rb");
+		if (file == nullptr)
+			return false;
+
+		_data.clear();
+		uint8_t chunk[64 << 10];
+		size_t read;
+		while ((read = std::fread(chunk, 1, sizeof(chunk), file)) != 0)
+			_data.insert(_data.end(), chunk, chunk + read);
+		std::fclose(file);
+
+		_pos = 0;
+		uint32_t magic = 0, version = 0;
+		return get(magic) && get(version) && magic == trace_format_s::magic && version == trace_format_s::version;
+	}
+
+	template <typename T>
+	bool get(T& value) {
+		if (_data.size() - _pos < sizeof(T))
+			return false;
+		std::memcpy(&value, _data.data() + _pos, sizeof(T));
+		_pos += sizeof(T);
+		return true;
+	}
+};
+
+// Epoch based reclamation for state that HLAE's calls read while ReShade's events change it on
+// other threads. Readers never block, a writer unpublishes an object, calls synchronize, which
+// waits for the readers that may still see it, and frees it afterwards.
+struct epoch_domain_s
+{
+	std::atomic<uint64_t> _epoch{ 0 };
+	std::atomic<uint32_t> _readers[2] = {};
+
+	uint64_t read_lock() {
+		for (;;) {
+			const uint64_t epoch = _epoch.load();
+			_readers[epoch & 1].fetch_add(1);
+			// A synchronize that flipped the epoch in between doesn't wait for this counter.
+			if (_epoch.load() == epoch)
+				return epoch;
+			_readers[epoch & 1].fetch_sub(1);
+		}
+	}
+
+	void read_unlock(uint64_t epoch) {
+		_readers[epoch & 1].fetch_sub(1, std::memory_order_release);
+	}
+
+	// Writers have to be serialized and must not be inside a read section of the same domain.
+	void synchronize() {
+		const uint64_t epoch = _epoch.fetch_add(1);
+		while (_readers[epoch & 1].load() != 0)
+			std::this_thread::yield();
+	}
+};
+
+struct epoch_guard_s
+{
+	epoch_domain_s& _domain;
+	const uint64_t _epoch;
+
+	explicit epoch_guard_s(epoch_domain_s& domain) : _domain(domain), _epoch(domain.read_lock()) {}
+	~epoch_guard_s() { _domain.read_unlock(_epoch); }
+
+	epoch_guard_s(const epoch_guard_s&) = delete;
+	epoch_guard_s& operator=(const epoch_guard_s&) = delete;
+};
+
+// Effect runtimes known to the addon as immutable snapshots, HLAE's calls read them without a lock
+// while ReShade creates and destroys runtimes on other threads.
+struct runtime_registry_s
+{
+	struct entry_s {
+		effect_runtime* runtime;
+		uint64_t serial; // Tells a runtime apart from a later one at the same address.
+	};
+
+	struct snapshot_s {
+		effect_runtime* main_runtime = nullptr;
+		std::vector<entry_s> runtimes;
+
+		const entry_s* find(effect_runtime* runtime) const {
+			for (const auto& entry : runtimes) {
+				if (entry.runtime == runtime)
+					return &entry;
+			}
+			return nullptr;
+		}
+	};
+
+	epoch_domain_s _epochs;
+	std::atomic<const snapshot_s*> _snapshot{ nullptr };
+	std::mutex _writer_mutex;
+	uint64_t _next_serial = 1;
+
+	~runtime_registry_s() {
+		delete _snapshot.load();
+	}
+
+	// Only valid inside a read section of _epochs, can be null.
+	const snapshot_s* get() const {
+		return _snapshot.load(std::memory_order_acquire);
+	}
+
+	bool is_main_runtime(effect_runtime* runtime) {
+		epoch_guard_s guard(_epochs);
+		const snapshot_s* snapshot = get();
+		return snapshot != nullptr && snapshot->main_runtime != nullptr && snapshot->main_runtime == runtime;
+	}
+
+	bool has_main_runtime() {
+		epoch_guard_s guard(_epochs);
+		const snapshot_s* snapshot = get();
+		return snapshot != nullptr && snapshot->main_runtime != nullptr;
+	}
+
+	void add(effect_runtime* runtime) {
+		modify([&](snapshot_s& snapshot) {
+			snapshot.runtimes.push_back({ runtime, _next_serial++ });
+			});
+	}
+
+	// Returns once no reader can see the runtime anymore, so its data can be destroyed then.
+	void remove(effect_runtime* runtime) {
+		modify([&](snapshot_s& snapshot) {
+			if (snapshot.main_runtime == runtime)
+				snapshot.main_runtime = nullptr;
+			snapshot.runtimes.erase(std::remove_if(snapshot.runtimes.begin(), snapshot.runtimes.end(),
+				[&](const entry_s& entry) { return entry.runtime == runtime; }), snapshot.runtimes.end());
+			});
+	}
+
+	// Only takes if there is no main runtime yet.
+	void set_main_runtime(effect_runtime* runtime) {
+		modify([&](snapshot_s& snapshot) {
+			if (snapshot.main_runtime == nullptr && snapshot.find(runtime) != nullptr)
+				snapshot.main_runtime = runtime;
+			});
+	}
+
+	template <typename F>
+	void modify(F&& change) {
+		std::lock_guard<std::mutex> lock(_writer_mutex);
+		const snapshot_s* old_snapshot = _snapshot.load();
+		snapshot_s* snapshot = old_snapshot != nullptr ? new snapshot_s(*old_snapshot) : new snapshot_s();
+		change(*snapshot);
+		_snapshot.store(snapshot, std::memory_order_release);
+		if (old_snapshot != nullptr) {
+			_epochs.synchronize();
+			delete old_snapshot;
+		}
+	}
+};
+
+struct ADVANCEDFX_UUID("9A609C4B-75C6-47C5-AFB5-4C65E0807F69") runtime_data_s
+{
+	// Read by ReShade's begin / finish effects events, which can run on another thread than HLAE's calls.
+	std::atomic<bool> block_effects{ true };
+	bool effects_were_enabled = true;
+	// In HLAE only mode the effects state stays off, so ReShade skips its present pass, and is only
+	// switched on during HLAE's render calls.
+	bool hlae_only = false;
+	// Set while the add-on switches the effects state itself, see set_effects_state.
+	bool switching_effects = false;
+	resource _current_depth_buffer_resource = { 0 };
+	resource_view _current_depth_texture_view = { 0 };
+	resource_view _current_linear_depth_view = { 0 };
+	resource_view _current_depth_mips_view = { 0 };
+	float _current_depth_near_plane = 0.0f;
+	float _current_depth_far_plane = 0.0f;
+	uniform_source_index_s _uniform_sources;
+	technique_table_s _techniques;
+	// Serial of the camera last written, see device_data_s::_camera_serial.
+	uint64_t _camera_serial = 0;
+	// Set by the reloaded effects event, the bindings are redone at the start of the next HLAE call.
+	std::atomic<bool> _reload_pending{ false };
+
+	// Previous frames of the stream being rendered, newest first, see device_data_s::_history_frames.
+	static constexpr uint32_t max_history_frames = 4;
+	resource_view _current_color_prev_views[max_history_frames] = {};
+	resource_view _current_depth_prev_views[max_history_frames] = {};
+
+	static const char* get_color_prev_name(uint32_t index) {
+		static const char* const names[max_history_frames] = { "COLOR_PREV", "COLOR_PREV2", "COLOR_PREV3", "COLOR_PREV4" };
+		return names[index];
+	}
+
+	static const char* get_depth_prev_name(uint32_t index) {
+		static const char* const names[max_history_frames] = { "DEPTH_PREV", "DEPTH_PREV2", "DEPTH_PREV3", "DEPTH_PREV4" };
+		return names[index];
+	}
+
+	void begin_hlae_effects(effect_runtime* runtime) {
+		set_effects_state(runtime, true);
+		block_effects = false;
+	}
+
+	void end_hlae_effects(effect_runtime* runtime) {
+		block_effects = true;
+		if (hlae_only)
+			set_effects_state(runtime, false);
+	}
+
+	// HLAE wants no effects: they are switched off until its next render call, in HLAE only mode they are off already.
+	void skip_hlae_effects(effect_runtime* runtime) {
+		if (!hlae_only)
+			set_effects_state(runtime, false);
+	}
+
+	// Lets the add-on's own switches through the reshade_set_effects_state event.
+	void set_effects_state(effect_runtime* runtime, bool enabled) {
+		switching_effects = true;
+		runtime->set_effects_state(enabled);
+		switching_effects = false;
+	}
+
+	void update_effect_runtime(effect_runtime* runtime) {
+		runtime->update_texture_bindings("DEPTH", _current_depth_texture_view, _current_depth_texture_view);
+		runtime->update_texture_bindings("DEPTH_LINEAR", _current_linear_depth_view, _current_linear_depth_view);
+		runtime->update_texture_bindings("DEPTH_MIPS", _current_depth_mips_view, _current_depth_mips_view);
+		for (uint32_t i = 0; i < max_history_frames; ++i) {
+			runtime->update_texture_bindings(get_color_prev_name(i), _current_color_prev_views[i], _current_color_prev_views[i]);
+			runtime->update_texture_bindings(get_depth_prev_name(i), _current_depth_prev_views[i], _current_depth_prev_views[i]);
+		}
+
+		for (const auto variable : _uniform_sources.get(runtime, uniform_source_index_s::source_bufready_depth))
+			runtime->set_uniform_value_bool(variable, _current_depth_texture_view != 0);
+		for (const auto variable : _uniform_sources.get(runtime, uniform_source_index_s::source_depth_near_plane))
+			runtime->set_uniform_value_float(variable, _current_depth_near_plane);
+		for (const auto variable : _uniform_sources.get(runtime, uniform_source_index_s::source_depth_far_plane))
+			runtime->set_uniform_value_float(variable, _current_depth_far_plane);
+	}
+
+	// Variable and technique handles change when effects are reloaded.
+	void on_reloaded_effects(effect_runtime* runtime) {
+		_uniform_sources.rebuild(runtime);
+		_techniques._valid = false;
+		_camera_serial = 0;
+		update_effect_runtime(runtime);
+	}
+
+	void update_camera(effect_runtime* runtime, const camera_uniforms_s& camera) {
+		const struct {
+			uniform_source_index_s::source_e source;
+			const float* values;
+			size_t count;
+		} sources[] = {
+			{ uniform_source_index_s::source_camera_fov, &camera.fov, 1 },
+			{ uniform_source_index_s::source_camera_near_plane, &camera.near_plane, 1 },
+			{ uniform_source_index_s::source_camera_far_plane, &camera.far_plane, 1 },
+			{ uniform_source_index_s::source_camera_origin, camera.origin, 3 },
+			{ uniform_source_index_s::source_camera_angles, camera.angles, 3 },
+			{ uniform_source_index_s::source_camera_view, camera.view, 16 },
+			{ uniform_source_index_s::source_camera_projection, camera.projection, 16 },
+			{ uniform_source_index_s::source_demo_time, &camera.demo_time, 1 }
+		};
+
+		for (const auto& source : sources) {
+			for (const auto variable : _uniform_sources.get(runtime, source.source))
+				runtime->set_uniform_value_float(variable, source.values, source.count);
+		}
+	}
+
+	void apply_pending_reload(effect_runtime* runtime) {
+		if (_reload_pending.exchange(false))
+			on_reloaded_effects(runtime);
+	}
+
+	void update_effect_runtime(effect_runtime* runtime, resource depth_buffer_resource, resource_view depth_texture_view,
+		resource_view linear_depth_view = { 0 }, resource_view depth_mips_view = { 0 }) {
+		_current_depth_buffer_resource = depth_buffer_resource;
+		_current_depth_texture_view = depth_texture_view;
+		_current_linear_depth_view = linear_depth_view;
+		_current_depth_mips_view = depth_mips_view;
+		this->update_effect_runtime(runtime);
+	}
+
+	// Only rebinds what changed, streams switch their history on every call.
+	void update_history(effect_runtime* runtime, const resource_view* color_views, const resource_view* depth_views) {
+		for (uint32_t i = 0; i < max_history_frames; ++i) {
+			if (_current_color_prev_views[i] != color_views[i]) {
+				_current_color_prev_views[i] = color_views[i];
+				runtime->update_texture_bindings(get_color_prev_name(i), color_views[i], color_views[i]);
+			}
+			if (_current_depth_prev_views[i] != depth_views[i]) {
+				_current_depth_prev_views[i] = depth_views[i];
+				runtime->update_texture_bindings(get_depth_prev_name(i), depth_views[i], depth_views[i]);
+			}
+		}
+	}
+
+	bool is_current(resource depth_buffer_resource, resource_view depth_texture_view, resource_view linear_depth_view, resource_view depth_mips_view) const {
+		return _current_depth_buffer_resource == depth_buffer_resource
+			&& _current_depth_texture_view == depth_texture_view
+			&& _current_linear_depth_view == linear_depth_view
+			&& _current_depth_mips_view == depth_mips_view;
+	}
+};
+
+inline void update_dependent_effect_runtime(effect_runtime* runtime, resource depth_buffer_resource, resource_view rsv,
+	resource_view linear_depth_view = { 0 }, resource_view depth_mips_view = { 0 }) {
+	auto data = runtime->get_private_data<runtime_data_s>();
+	data->update_effect_runtime(runtime, depth_buffer_resource, rsv, linear_depth_view, depth_mips_view);
+}
+
+struct ADVANCEDFX_UUID("4F2FCBC8-D459-4325-A4D8-4EE63F5C4571") device_data_s
+{
+	struct back_buffer_data_s {
+		bool _hasBackBuffer = false;
+		resource_desc _back_buffer_desc;
+		uint32_t _width;
+		uint32_t _height;
+		format _back_buffer_format;
+		uint16_t _back_buffer_samples;
+		resource _back_buffer_resolved = { 0 };
+		resource_view _back_buffer_resolved_srv = {};
+		resource_view _back_buffer_targets[2] = {};
+		resource_view _back_buffer_revoled_targets[2] = {};
+		// The state HLAE hands the back buffer in and expects it back in: present if its MSAA or format
+		// needs the resolve texture, else the one for its usage, also when the resolve texture is forced.
+		resource_usage _hlae_state = resource_usage::undefined;
+
+		// Effects render at 1 / _scale of the size into _scaled_texture, see render_scaled.
+		uint32_t _scale = 1;
+		uint32_t _scaled_width = 0;
+		uint32_t _scaled_height = 0;
+		resource _scaled_texture = { 0 };
+		resource_view _scaled_srv = { 0 };
+		resource_view _scaled_targets[2] = {};
+
+		// Effects only process this part of the target unless it is empty, see render_cropped.
+		rect _crop = { 0, 0, 0, 0 };
+		uint32_t _crop_width = 0;
+		uint32_t _crop_height = 0;
+		resource _crop_texture = { 0 };
+		resource_view _crop_srv = { 0 };
+		resource_view _crop_targets[2] = {};
+
+		// Previous processed images and depth textures of this stream, newest first. The resolve texture
+		// and the depth texture are swapped into them after use, see rotate_color_history.
+		struct history_color_s {
+			resource texture = { 0 };
+			resource_view srv = { 0 };
+			resource_view targets[2] = {};
+		};
+		struct history_depth_s {
+			resource texture = { 0 };
+			resource_view srv = { 0 };
+			resource_view rtv = { 0 };
+			resource_desc desc; // Of the depth buffer it was made from.
+		};
+		std::vector<history_color_s> _color_history;
+		std::vector<history_depth_s> _depth_history;
+
+		static void free_history_depth(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states, history_depth_s& slot) {
+			for (auto view : { &slot.srv, &slot.rtv }) {
+				if (*view != 0)
+					texture_pool.retire_view(device, *view);
+				*view = { 0 };
+			}
+			if (slot.texture != 0) {
+				texture_pool.release(device, slot.texture, resource_states.get_state(slot.texture));
+				resource_states.forget(slot.texture);
+				slot.texture = { 0 };
+			}
+		}
+
+		void free_history(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			for (auto& slot : _color_history) {
+				for (auto view : { &slot.srv, &slot.targets[0], &slot.targets[1] }) {
+					if (*view != 0)
+						texture_pool.retire_view(device, *view);
+				}
+				if (slot.texture != 0) {
+					texture_pool.release(device, slot.texture, resource_states.get_state(slot.texture));
+					resource_states.forget(slot.texture);
+				}
+			}
+			_color_history.clear();
+			for (auto& slot : _depth_history)
+				free_history_depth(device, texture_pool, resource_states, slot);
+			_depth_history.clear();
+		}
+
+		bool has_crop() const {
+			return _crop.right > _crop.left && _crop.bottom > _crop.top;
+		}
+
+		// _crop clipped to the target, false if that is empty or the whole target.
+		bool get_crop_rect(rect* out_rect) const {
+			const rect clipped = {
+				std::max(_crop.left, 0), std::max(_crop.top, 0),
+				std::min(_crop.right, static_cast<int32_t>(_width)), std::min(_crop.bottom, static_cast<int32_t>(_height)) };
+			if (clipped.right <= clipped.left || clipped.bottom <= clipped.top)
+				return false;
+			if (clipped.left == 0 && clipped.top == 0 && clipped.right == static_cast<int32_t>(_width) && clipped.bottom == static_cast<int32_t>(_height))
+				return false;
+			*out_rect = clipped;
+			return true;
+		}
+
+		void free_cropped(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			for (auto view : { &_crop_srv, &_crop_targets[0], &_crop_targets[1] }) {
+				if (*view != 0)
+					texture_pool.retire_view(device, *view);
+				*view = { 0 };
+			}
+			if (_crop_texture != 0) {
+				texture_pool.release(device, _crop_texture, resource_states.get_state(_crop_texture));
+				resource_states.forget(_crop_texture);
+				_crop_texture = { 0 };
+			}
+		}
+
+		bool ensure_cropped(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states, uint32_t width, uint32_t height) {
+			if (_crop_texture != 0 && _crop_width == width && _crop_height == height)
+				return true;
+
+			free_cropped(device, texture_pool, resource_states);
+			_crop_width = width;
+			_crop_height = height;
+
+			resource_usage state;
+			if (!texture_pool.acquire(device,
+				texture_pool_s::key_s{ width, height, format_to_typeless(_back_buffer_format), 1, resource_usage::render_target | resource_usage::shader_resource | resource_usage::copy_dest | resource_usage::copy_source },
+				resource_usage::copy_dest, "ReShade advancedfx cropped target", &_crop_texture, &state))
+				return false;
+			resource_states.set_state(_crop_texture, state);
+
+			if (!device->create_resource_view(_crop_texture, resource_usage::shader_resource, resource_view_desc(_back_buffer_format), &_crop_srv)
+				|| !device->create_resource_view(_crop_texture, resource_usage::render_target, resource_view_desc(format_to_default_typed(_back_buffer_format, 0)), &_crop_targets[0])
+				|| !device->create_resource_view(_crop_texture, resource_usage::render_target, resource_view_desc(format_to_default_typed(_back_buffer_format, 1)), &_crop_targets[1])) {
+				free_cropped(device, texture_pool, resource_states);
+				return false;
+			}
+			return true;
+		}
+
+		void free_scaled(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			for (auto view : { &_scaled_srv, &_scaled_targets[0], &_scaled_targets[1] }) {
+				if (*view != 0)
+					texture_pool.retire_view(device, *view);
+				*view = { 0 };
+			}
+			if (_scaled_texture != 0) {
+				texture_pool.release(device, _scaled_texture, resource_states.get_state(_scaled_texture));
+				resource_states.forget(_scaled_texture);
+				_scaled_texture = { 0 };
+			}
+		}
+
+		// Needs the resolve texture, which ensure_buffers creates when called with force_resolve.
+		bool ensure_scaled(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			const uint32_t width = std::max(1u, (_width + _scale - 1) / _scale);
+			const uint32_t height = std::max(1u, (_height + _scale - 1) / _scale);
+			if (_scaled_texture != 0 && _scaled_width == width && _scaled_height == height)
+				return true;
+
+			free_scaled(device, texture_pool, resource_states);
+			_scaled_width = width;
+			_scaled_height = height;
+
+			resource_usage state;
+			if (!texture_pool.acquire(device,
+				texture_pool_s::key_s{ width, height, format_to_typeless(_back_buffer_format), 1, resource_usage::render_target | resource_usage::shader_resource },
+				resource_usage::render_target, "ReShade advancedfx scaled target", &_scaled_texture, &state))
+				return false;
+			resource_states.set_state(_scaled_texture, state);
+
+			if (!device->create_resource_view(_scaled_texture, resource_usage::shader_resource, resource_view_desc(_back_buffer_format), &_scaled_srv)
+				|| !device->create_resource_view(_scaled_texture, resource_usage::render_target, resource_view_desc(format_to_default_typed(_back_buffer_format, 0)), &_scaled_targets[0])
+				|| !device->create_resource_view(_scaled_texture, resource_usage::render_target, resource_view_desc(format_to_default_typed(_back_buffer_format, 1)), &_scaled_targets[1])) {
+				free_scaled(device, texture_pool, resource_states);
+				return false;
+			}
+			return true;
+		}
+
+		// Also called on partially created buffers (when ensure_buffers fails), so don't check _hasBackBuffer here.
+		void free_buffer_resources(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			free_scaled(device, texture_pool, resource_states);
+			free_cropped(device, texture_pool, resource_states);
+			free_history(device, texture_pool, resource_states);
+			for (auto& view : _back_buffer_revoled_targets) {
+				if (view != 0)
+					texture_pool.retire_view(device, view);
+				view = {};
+			}
+
+			if (_back_buffer_resolved_srv != 0) {
+				texture_pool.retire_view(device, _back_buffer_resolved_srv);
+				_back_buffer_resolved_srv = {};
+			}
+			if (_back_buffer_resolved != 0) {
+				texture_pool.release(device, _back_buffer_resolved, resource_states.get_state(_back_buffer_resolved));
+				resource_states.forget(_back_buffer_resolved);
+				_back_buffer_resolved = {};
+			}
+
+			for (auto& view : _back_buffer_targets) {
+				if (view != 0)
+					texture_pool.retire_view(device, view);
+				view = {};
+			}
+
+			_hasBackBuffer = false;
+		}
+
+		// Creates render targets with the alpha variant of an X8 format on the back buffer itself. Only Vulkan and
+		// OpenGL can view an X8 texture as A8, DXGI has no typeless family holding both (BGRX and BGRA are
+		// separate ones, RGBX doesn't exist there), so D3D always gets a resolve texture.
+		bool create_alias_targets(device* device, resource back_buffer_resource) {
+			if (device->get_api() != device_api::vulkan && device->get_api() != device_api::opengl)
+				return false;
+
+			if (device->create_resource_view(back_buffer_resource, resource_usage::render_target, resource_view_desc(format_to_default_typed(_back_buffer_format, 0)), &_back_buffer_targets[0])
+				&& device->create_resource_view(back_buffer_resource, resource_usage::render_target, resource_view_desc(format_to_default_typed(_back_buffer_format, 1)), &_back_buffer_targets[1]))
+				return true;
+
+			for (auto& view : _back_buffer_targets) {
+				if (view != 0)
+					device->destroy_resource_view(view);
+				view = {};
+			}
+			return false;
+		}
+
+		// _back_buffer_resolved and its views for the size and format ensure_buffers set up.
+		bool create_resolve_texture(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			const bool need_copy_pipeline = pipeline_cache_s::is_supported(device, pipeline_cache_s::kind_copy);
+
+			// copy_source for read back and for the copy write-back used when no copy pipeline is available.
+			resource_usage usage = resource_usage::render_target | resource_usage::copy_dest | resource_usage::resolve_dest | resource_usage::copy_source;
+			if (need_copy_pipeline)
+				usage |= resource_usage::shader_resource;
+
+			resource_usage resolved_state;
+			if (!texture_pool.acquire(device,
+				texture_pool_s::key_s{ _width, _height, format_to_typeless(_back_buffer_format), 1, usage },
+				_back_buffer_samples == 1 ? resource_usage::copy_dest : resource_usage::resolve_dest,
+				nullptr, &_back_buffer_resolved, &resolved_state))
+				return false;
+			resource_states.set_state(_back_buffer_resolved, resolved_state);
+
+			if (!device->create_resource_view(
+					_back_buffer_resolved,
+					resource_usage::render_target,
+					resource_view_desc(format_to_default_typed(_back_buffer_format, 0)),
+					&_back_buffer_revoled_targets[0]) ||
+				!device->create_resource_view(
+					_back_buffer_resolved,
+					resource_usage::render_target,
+					resource_view_desc(format_to_default_typed(_back_buffer_format, 1)),
+					&_back_buffer_revoled_targets[1]))
+				return false;
+
+			if (need_copy_pipeline)
+			{
+				if (!device->create_resource_view(
+					_back_buffer_resolved,
+					resource_usage::shader_resource,
+					resource_view_desc(_back_buffer_format),
+					&_back_buffer_resolved_srv))
+					return false;
+			}
+			return true;
+		}
+
+		// force_resolve makes effects work on a copy even if they could render into the back buffer directly.
+		bool ensure_buffers(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states, resource back_buffer_resource, bool force_resolve) {
+			// The entry is dropped when HLAE destroys the resource, so as long as it is alive the desc can't change.
+			if (_hasBackBuffer && (_back_buffer_resolved != 0 || !force_resolve))
+				return true;
+
+			const resource_desc back_buffer_desc = device->get_resource_desc(back_buffer_resource);
+
+			free_buffer_resources(device, texture_pool, resource_states);
+
+			_back_buffer_desc = back_buffer_desc;
+
+			_width = back_buffer_desc.texture.width;
+			_height = back_buffer_desc.texture.height;
+			_back_buffer_format = format_to_default_typed(back_buffer_desc.texture.format);
+			_back_buffer_samples = back_buffer_desc.texture.samples;
+
+			const bool needs_resolve = back_buffer_desc.texture.samples > 1
+				// Some effects rely on there being an alpha channel available, so create resolve texture if that is not the case
+				|| (_back_buffer_format == format::r8g8b8x8_unorm || _back_buffer_format == format::b8g8r8x8_unorm
+					|| _back_buffer_format == format::r8g8b8x8_unorm_srgb || _back_buffer_format == format::b8g8r8x8_unorm_srgb);
+			_hlae_state = needs_resolve ? resource_usage::present : back_buffer_desc.usage;
+
+			// Create resolve texture and copy pipeline (do this before creating effect resources, to ensure correct back buffer format is set up)
+			if (force_resolve || needs_resolve)
+			{
+				switch (_back_buffer_format)
+				{
+				case format::r8g8b8x8_unorm:
+				case format::r8g8b8x8_unorm_srgb:
+					_back_buffer_format = format::r8g8b8a8_unorm;
+					break;
+				case format::b8g8r8x8_unorm:
+				case format::b8g8r8x8_unorm_srgb:
+					_back_buffer_format = format::b8g8r8a8_unorm;
+					break;
+				}
+
+				// Without MSAA the back buffer may allow views with the alpha format directly, then effects render in place.
+				if (!force_resolve && back_buffer_desc.texture.samples == 1 && create_alias_targets(device, back_buffer_resource)) {
+					_hlae_state = back_buffer_desc.usage;
+					_hasBackBuffer = true;
+					return true;
+				}
+
+				if (!create_resolve_texture(device, texture_pool, resource_states)) {
+					free_buffer_resources(device, texture_pool, resource_states);
+					return false;
+				}
+			}
+			// Create render targets for the back buffer resources
+			if (!device->create_resource_view(
+				back_buffer_resource,
+				resource_usage::render_target,
+				resource_view_desc(
+					back_buffer_desc.texture.samples > 1 ? resource_view_type::texture_2d_multisample : resource_view_type::texture_2d,
+					format_to_default_typed(back_buffer_desc.texture.format, 0), 0, 1, 0, 1),
+				&_back_buffer_targets[0]) ||
+				!device->create_resource_view(
+					back_buffer_resource,
+					resource_usage::render_target,
+					resource_view_desc(
+						back_buffer_desc.texture.samples > 1 ? resource_view_type::texture_2d_multisample : resource_view_type::texture_2d,
+						format_to_default_typed(back_buffer_desc.texture.format, 1), 0, 1, 0, 1),
+					&_back_buffer_targets[1]))
+			{
+				free_buffer_resources(device, texture_pool, resource_states);
+				return false;
+			}
+
+			_hasBackBuffer = true;
+			return true;
+		}
+	};
+
+	struct depth_texture_data_s {
+		resource_desc _depth_desc;
+		resource _depth_texture = { 0 };
+		resource_view _depth_texture_view = { 0 };
+		bool _allow_direct_binding = false;
+
+		// Set when HLAE's depth is multisampled, _depth_texture is then rendered by render_depth_resolve
+		// instead of being copied.
+		resource_view _depth_ms_srv = { 0 };
+		resource_view _depth_texture_rtv = { 0 };
+
+		// Linear depth and its min / max pyramid, see render_linear_depth.
+		resource _linear_depth_texture = { 0 };
+		resource_view _linear_depth_srv = { 0 };
+		resource_view _linear_depth_rtv = { 0 };
+		resource _depth_mips_texture = { 0 };
+		resource_view _depth_mips_srv = { 0 };
+		std::vector<resource_view> _depth_mips_level_srvs;
+		std::vector<resource_view> _depth_mips_level_rtvs;
+		uint64_t _linear_depth_serial = 0;
+
+		void free_linear_depth(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			for (auto view : { _linear_depth_srv, _linear_depth_rtv, _depth_mips_srv }) {
+				if (view != 0)
+					texture_pool.retire_view(device, view);
+			}
+			_linear_depth_srv = { 0 };
+			_linear_depth_rtv = { 0 };
+			_depth_mips_srv = { 0 };
+			for (auto& views : { &_depth_mips_level_srvs, &_depth_mips_level_rtvs }) {
+				for (auto view : *views) {
+					if (view != 0)
+						texture_pool.retire_view(device, view);
+				}
+				views->clear();
+			}
+			for (auto texture : { &_linear_depth_texture, &_depth_mips_texture }) {
+				if (*texture != 0) {
+					texture_pool.release(device, *texture, resource_states.get_state(*texture));
+					resource_states.forget(*texture);
+					*texture = { 0 };
+				}
+			}
+			_linear_depth_serial = 0;
+		}
+
+		// Level 0 of the pyramid has the size of the depth buffer, it goes down to 1x1.
+		bool ensure_linear_depth(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			if (_linear_depth_srv != 0)
+				return true;
+
+			const uint32_t width = _depth_desc.texture.width;
+			const uint32_t height = _depth_desc.texture.height;
+			uint16_t levels = 1;
+			while ((std::max(width, height) >> levels) != 0)
+				++levels;
+
+			const resource_usage usage = resource_usage::shader_resource | resource_usage::render_target;
+			resource_usage state;
+			if (!texture_pool.acquire(device, texture_pool_s::key_s{ width, height, format::r32_float, 1, usage },
+				resource_usage::shader_resource, "ReShade advancedfx linear depth", &_linear_depth_texture, &state))
+				return false;
+			resource_states.set_state(_linear_depth_texture, state);
+
+			if (!texture_pool.acquire(device, texture_pool_s::key_s{ width, height, format::r32g32_float, 1, usage, memory_heap::gpu_only, levels },
+				resource_usage::shader_resource, "ReShade advancedfx depth mips", &_depth_mips_texture, &state)) {
+				free_linear_depth(device, texture_pool, resource_states);
+				return false;
+			}
+			resource_states.set_state(_depth_mips_texture, state);
+
+			bool result =
+				device->create_resource_view(_linear_depth_texture, resource_usage::shader_resource, resource_view_desc(format::r32_float), &_linear_depth_srv)
+				&& device->create_resource_view(_linear_depth_texture, resource_usage::render_target, resource_view_desc(format::r32_float), &_linear_depth_rtv)
+				&& device->create_resource_view(_depth_mips_texture, resource_usage::shader_resource, resource_view_desc(resource_view_type::texture_2d, format::r32g32_float, 0, levels, 0, 1), &_depth_mips_srv);
+
+			_depth_mips_level_srvs.resize(levels);
+			_depth_mips_level_rtvs.resize(levels);
+			for (uint16_t level = 0; result && level < levels; ++level) {
+				result = device->create_resource_view(_depth_mips_texture, resource_usage::shader_resource, resource_view_desc(resource_view_type::texture_2d, format::r32g32_float, level, 1, 0, 1), &_depth_mips_level_srvs[level])
+					&& device->create_resource_view(_depth_mips_texture, resource_usage::render_target, resource_view_desc(resource_view_type::texture_2d, format::r32g32_float, level, 1, 0, 1), &_depth_mips_level_rtvs[level]);
+			}
+
+			if (!result)
+				free_linear_depth(device, texture_pool, resource_states);
+			return result;
+		}
+
+		// Point sampled copy of the depth for streams rendered at reduced size.
+		resource _scaled_depth_texture = { 0 };
+		resource_view _scaled_depth_srv = { 0 };
+		resource_view _scaled_depth_rtv = { 0 };
+		uint32_t _scaled_depth_width = 0;
+		uint32_t _scaled_depth_height = 0;
+
+		void free_scaled_depth(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			for (auto view : { &_scaled_depth_srv, &_scaled_depth_rtv }) {
+				if (*view != 0)
+					texture_pool.retire_view(device, *view);
+				*view = { 0 };
+			}
+			if (_scaled_depth_texture != 0) {
+				texture_pool.release(device, _scaled_depth_texture, resource_states.get_state(_scaled_depth_texture));
+				resource_states.forget(_scaled_depth_texture);
+				_scaled_depth_texture = { 0 };
+			}
+		}
+
+		bool ensure_scaled_depth(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states, uint32_t width, uint32_t height) {
+			if (_scaled_depth_texture != 0 && _scaled_depth_width == width && _scaled_depth_height == height)
+				return true;
+
+			free_scaled_depth(device, texture_pool, resource_states);
+			_scaled_depth_width = width;
+			_scaled_depth_height = height;
+
+			resource_usage state;
+			if (!texture_pool.acquire(device,
+				texture_pool_s::key_s{ width, height, format::r32_float, 1, resource_usage::shader_resource | resource_usage::render_target },
+				resource_usage::shader_resource, "ReShade advancedfx scaled depth", &_scaled_depth_texture, &state))
+				return false;
+			resource_states.set_state(_scaled_depth_texture, state);
+
+			if (!device->create_resource_view(_scaled_depth_texture, resource_usage::shader_resource, resource_view_desc(format::r32_float), &_scaled_depth_srv)
+				|| !device->create_resource_view(_scaled_depth_texture, resource_usage::render_target, resource_view_desc(format::r32_float), &_scaled_depth_rtv)) {
+				free_scaled_depth(device, texture_pool, resource_states);
+				return false;
+			}
+			return true;
+		}
+
+		void free_depth_resources(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			free_scaled_depth(device, texture_pool, resource_states);
+			free_linear_depth(device, texture_pool, resource_states);
+			for (auto view : { &_depth_ms_srv, &_depth_texture_rtv }) {
+				if (*view != 0)
+					texture_pool.retire_view(device, *view);
+				*view = { 0 };
+			}
+			if (_depth_texture_view != 0) {
+				texture_pool.retire_view(device, _depth_texture_view);
+				_depth_texture_view = { 0 };
+			}
+			if (_depth_texture != 0) {
+				texture_pool.release(device, _depth_texture, resource_states.get_state(_depth_texture));
+				resource_states.forget(_depth_texture);
+				_depth_texture = { 0 };
+			}
+		}
+
+		static bool is_depth_stencil_typed(format format) {
+			switch (format) {
+			case format::d16_unorm:
+			case format::d24_unorm_s8_uint:
+			case format::d32_float:
+			case format::d32_float_s8_uint:
+				return true;
+			}
+			return false;
+		}
+
+		// _depth_texture and its views for _depth_desc. Multisampled depth gets an R32F texture that
+		// render_depth_resolve draws into, otherwise it is a copy in the depth buffer's format.
+		bool create_depth_texture(device* device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states) {
+			const bool resolved = _depth_desc.texture.samples > 1;
+
+			resource_usage depth_texture_state;
+			if (!texture_pool.acquire(device,
+				texture_pool_s::key_s{ _depth_desc.texture.width, _depth_desc.texture.height, resolved ? format::r32_float : _depth_desc.texture.format, 1,
+					resource_usage::shader_resource | (resolved ? resource_usage::render_target : resource_usage::copy_dest) },
+				resolved ? resource_usage::shader_resource : resource_usage::copy_dest, "ReShade advancedfx depth texture",
+				&_depth_texture, &depth_texture_state))
+				return false;
+			resource_states.set_state(_depth_texture, depth_texture_state);
+
+			if (resolved)
+				return device->create_resource_view(_depth_texture, resource_usage::render_target, resource_view_desc(format::r32_float), &_depth_texture_rtv)
+					&& device->create_resource_view(_depth_texture, resource_usage::shader_resource, resource_view_desc(format::r32_float), &_depth_texture_view);
+			return device->create_resource_view(_depth_texture, resource_usage::shader_resource, resource_view_desc(format_to_default_typed(_depth_desc.texture.format)), &_depth_texture_view);
+		}
+
+		// Returns true if the depth is available in _depth_texture_view, if _depth_texture is 0 then the view
+		// was created directly on depth_texture_resource and no copy is needed.
+		bool supply_depth(device * device, texture_pool_s& texture_pool, resource_state_tracker_s& resource_states, resource depth_texture_resource, bool allow_direct_binding, bool allow_resolve) {
+			if (depth_texture_resource == 0) {
+				free_depth_resources(device, texture_pool, resource_states);
+				return false;
+			}
+
+			// Same as for the back buffer, the entry is dropped when HLAE destroys the resource.
+			if (_depth_texture_view != 0 && _allow_direct_binding == allow_direct_binding)
+				return true;
+
+			free_depth_resources(device, texture_pool, resource_states);
+
+			const resource_desc rs_depth_desc(device->get_resource_desc(depth_texture_resource));
+			_depth_desc = rs_depth_desc;
+			_allow_direct_binding = allow_direct_binding;
+			if (rs_depth_desc.texture.samples > 1) {
+				// Multisampled depth can't be copied, it is resolved into an R32F texture with a shader instead.
+				if (!allow_resolve
+					|| (rs_depth_desc.usage & resource_usage::shader_resource) == 0
+					|| is_depth_stencil_typed(rs_depth_desc.texture.format))
+					return false;
+
+				if (!device->create_resource_view(depth_texture_resource, resource_usage::shader_resource,
+						resource_view_desc(resource_view_type::texture_2d_multisample, format_to_default_typed(rs_depth_desc.texture.format), 0, 1, 0, 1), &_depth_ms_srv)
+					|| !create_depth_texture(device, texture_pool, resource_states)) {
+					free_depth_resources(device, texture_pool, resource_states);
+					return false;
+				}
+			}
+			else
+			{
+				resource_view_desc view_desc(format_to_default_typed(rs_depth_desc.texture.format));
+
+				// Sample HLAE's depth buffer directly if it allows it, saves a full copy per call.
+				if (allow_direct_binding
+					&& (rs_depth_desc.usage & resource_usage::shader_resource) != 0
+					&& !is_depth_stencil_typed(rs_depth_desc.texture.format)
+					&& device->create_resource_view(depth_texture_resource, resource_usage::shader_resource, view_desc, &_depth_texture_view))
+					return true;
+
+				if (!create_depth_texture(device, texture_pool, resource_states)) {
+					free_depth_resources(device, texture_pool, resource_states);
+					return false;
+				}
+			}
+
+			return _depth_texture_view != 0;
+		}
+	};
+
+	resource_table_s<back_buffer_data_s> _back_buffers;
+	resource_table_s<depth_texture_data_s> _depth_buffers;
+	// Streams bound to an effect runtime other than the main one.
+	resource_table_s<runtime_registry_s::entry_s> _stream_runtimes;
+	texture_pool_s _texture_pool;
+	resource_state_tracker_s _resource_states;
+	bool _direct_depth_binding = true;
+	bool _hlae_only = false;
+	// Frames each stream keeps for COLOR_PREV / DEPTH_PREV (up to runtime_data_s::max_history_frames,
+	// 0 = off). Depth is then always copied, since a texture HLAE owns can't be moved into the ring.
+	uint32_t _history_frames = 0;
+	render_stats_s _render_stats;
+	trace_writer_s _trace;
+	std::vector<trace_writer_s::entry_s> _trace_entries;
+
+	enum depth_resolve_e : uint32_t {
+		depth_resolve_sample0 = 0,
+		depth_resolve_min,
+		depth_resolve_max
+	};
+	uint32_t _depth_resolve_mode = depth_resolve_sample0;
+	// View depth range of HLAE's projection, the linear depth pass is off while both are 0.
+	float _depth_near_plane = 0.0f;
+	float _depth_far_plane = 0.0f;
+	// Set by AdvancedfxSetUniforms, the serial counts the updates (0 = never set), so each runtime
+	// writes the uniforms once per update.
+	camera_uniforms_s _camera = {};
+	uint64_t _camera_serial = 0;
+	// Counts render_effects calls, so the linear depth is built once per call for each depth buffer.
+	uint64_t _render_serial = 0;
+
+	// Processed images of keyed calls, a later call in the same frame with the same key, runtime, depth
+	// buffer, target size / format and render scale copies the image instead of running the effects again.
+	struct effect_cache_entry_s {
+		uint64_t content_key;
+		effect_runtime* runtime;
+		bool use_technique_mask;
+		uint64_t technique_mask;
+		resource depth_buffer_resource;
+		uint32_t width;
+		uint32_t height;
+		uint32_t scale;
+		reshade::api::format texture_format;
+		resource texture;
+	};
+
+	std::vector<effect_cache_entry_s> _effect_cache;
+	// Counts the main runtime's presents, which may happen on another thread than HLAE's calls.
+	std::atomic<uint64_t> _frame_serial{ 0 };
+	uint64_t _call_frame_serial = 0;
+
+	// The tables above are only used inside HLAE's calls, which hold a call_section_s. on_destroy_resource
+	// runs on the thread the game destroys resources on: it checks the resources HLAE passed in against a
+	// published sorted copy, and for those it waits for the calls in progress and holds off new ones while
+	// it drops the runtimes' bindings of the resource and the views and textures kept for it. Erasing the
+	// table entries is left to the next call, begin_hlae_call.
+	struct destroyed_resource_s {
+		resource handle;
+		std::chrono::steady_clock::time_point time; // Of the destroy event, for the trace.
+	};
+
+	epoch_domain_s _watched_epochs;
+	std::atomic<const std::vector<uint64_t>*> _watched_published{ nullptr };
+	std::vector<uint64_t> _watched;
+	bool _watched_changed = false;
+	epoch_domain_s _call_epochs;
+	std::atomic<bool> _freeing{ false };
+	std::mutex _freeing_mutex;
+	std::vector<destroyed_resource_s> _destroyed;
+
+	void watch(resource res) {
+		if (res == 0)
+			return;
+		auto it = std::lower_bound(_watched.begin(), _watched.end(), res.handle);
+		if (it != _watched.end() && *it == res.handle)
+			return;
+		_watched.insert(it, res.handle);
+		_watched_changed = true;
+	}
+
+	void unwatch(resource res) {
+		auto it = std::lower_bound(_watched.begin(), _watched.end(), res.handle);
+		if (it == _watched.end() || *it != res.handle)
+			return;
+		_watched.erase(it);
+		_watched_changed = true;
+	}
+
+	void publish_watched() {
+		if (!_watched_changed)
+			return;
+		_watched_changed = false;
+		const auto old_watched = _watched_published.exchange(new std::vector<uint64_t>(_watched), std::memory_order_acq_rel);
+		if (old_watched != nullptr) {
+			_watched_epochs.synchronize();
+			delete old_watched;
+		}
+	}
+
+	// Set while this thread is inside an HLAE call, a destroy_resource event it causes has the tables already.
+	static bool& in_hlae_call() {
+		static thread_local bool in_call = false;
+		return in_call;
+	}
+
+	// Held for the duration of an HLAE call, takes no lock unless on_destroy_resource is freeing.
+	struct call_section_s {
+		device_data_s* const _device_data;
+		uint64_t _epoch = 0;
+
+		explicit call_section_s(device_data_s* device_data) : _device_data(in_hlae_call() ? nullptr : device_data) {
+			if (_device_data == nullptr)
+				return;
+			_epoch = _device_data->enter_call();
+			in_hlae_call() = true;
+		}
+		~call_section_s() {
+			if (_device_data == nullptr)
+				return;
+			in_hlae_call() = false;
+			_device_data->_call_epochs.read_unlock(_epoch);
+		}
+
+		call_section_s(const call_section_s&) = delete;
+		call_section_s& operator=(const call_section_s&) = delete;
+	};
+
+	uint64_t enter_call() {
+		for (;;) {
+			const uint64_t epoch = _call_epochs.read_lock();
+			if (!_freeing.load())
+				return epoch;
+			_call_epochs.read_unlock(epoch);
+			while (_freeing.load())
+				std::this_thread::yield();
+		}
+	}
+
+	// Any thread. runtimes is the snapshot of a runtime registry read section the caller holds, can be null.
+	void on_destroy_resource(device* device, resource res, const runtime_registry_s::snapshot_s* runtimes) {
+		{
+			epoch_guard_s guard(_watched_epochs);
+			const auto watched = _watched_published.load(std::memory_order_acquire);
+			if (watched == nullptr || !std::binary_search(watched->begin(), watched->end(), res.handle))
+				return;
+		}
+
+		const auto time = std::chrono::steady_clock::now();
+		if (in_hlae_call()) {
+			release_resource(device, res, runtimes);
+			_destroyed.push_back({ res, time });
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(_freeing_mutex);
+		_freeing.store(true);
+		_call_epochs.synchronize();
+		release_resource(device, res, runtimes);
+		_destroyed.push_back({ res, time });
+		_freeing.store(false);
+	}
+
+	// What can't wait for the next call: a runtime could still render with a binding of the resource, and
+	// views on it must not outlive it.
+	void release_resource(device* device, resource res, const runtime_registry_s::snapshot_s* runtimes) {
+		auto depth_texture_data = _depth_buffers.find(res);
+		auto back_buffer_data = _back_buffers.find(res);
+		if (runtimes != nullptr && (depth_texture_data != nullptr || back_buffer_data != nullptr))
+			unbind_history(device, *runtimes);
+		if (depth_texture_data != nullptr) {
+			if (runtimes != nullptr)
+				unbind_depth(device, res, *runtimes);
+			depth_texture_data->free_depth_resources(device, _texture_pool, _resource_states);
+		}
+		if (back_buffer_data != nullptr)
+			back_buffer_data->free_buffer_resources(device, _texture_pool, _resource_states);
+		_texture_pool._retired.destroy_views_of(device, res);
+	}
+
+	// Called at the start of HLAE's calls, inside a call section and a read section of the runtime registry.
+	void begin_hlae_call(device* device, const runtime_registry_s::snapshot_s& runtimes) {
+		// In order, a handle can be destroyed, reused and destroyed again.
+		for (const auto& destroyed : _destroyed) {
+			if (_trace.is_active())
+				_trace.write_destroy(destroyed.handle, destroyed.time);
+			free_resource(device, destroyed.handle, runtimes);
+		}
+		_destroyed.clear();
+		publish_watched();
+
+		const uint64_t frame_serial = _frame_serial.load(std::memory_order_acquire);
+		if (frame_serial != _call_frame_serial) {
+			clear_effect_cache(device);
+			if (_trace.is_active())
+				_trace.flush();
+			_call_frame_serial = frame_serial;
+		}
+	}
+
+	// Drops everything kept for a resource that HLAE passed in.
+	void free_resource(device* device, resource res, const runtime_registry_s::snapshot_s& runtimes) {
+		if (_depth_buffers.find(res) != nullptr || _back_buffers.find(res) != nullptr)
+			unbind_history(device, runtimes);
+		free_depth_resources(device, res, runtimes);
+		free_buffer_resources(device, res);
+		unwatch(res);
+	}
+
+	// Runtimes keep the history of the stream rendered last bound after a call. Its views move between the
+	// ring, the resolve texture and the depth texture as the ring rotates, so before any of them is freed
+	// all history bindings are dropped. Each pass binds its stream's history again.
+	void unbind_history(device* device, const runtime_registry_s::snapshot_s& runtimes) {
+		if (_history_frames == 0)
+			return;
+
+		const resource_view no_views[runtime_data_s::max_history_frames] = {};
+		for (const auto& entry : runtimes.runtimes) {
+			if (entry.runtime->get_device() == device)
+				entry.runtime->get_private_data<runtime_data_s>()->update_history(entry.runtime, no_views, no_views);
+		}
+	}
+
+	// Called at the end of a frame, the textures go back to the pool for the next frame's entries.
+	void clear_effect_cache(device* device) {
+		for (const auto& entry : _effect_cache) {
+			_texture_pool.release(device, entry.texture, _resource_states.get_state(entry.texture));
+			_resource_states.forget(entry.texture);
+		}
+		_effect_cache.clear();
+	}
+
+	void free_depth_resources(device* device, resource depth_texture_resource, const runtime_registry_s::snapshot_s& runtimes) {
+		for (size_t i = 0; i < _effect_cache.size();) {
+			if (_effect_cache[i].depth_buffer_resource == depth_texture_resource) {
+				_texture_pool.release(device, _effect_cache[i].texture, _resource_states.get_state(_effect_cache[i].texture));
+				_resource_states.forget(_effect_cache[i].texture);
+				_effect_cache.erase(_effect_cache.begin() + i);
+			}
+			else
+				++i;
+		}
+
+		if (auto depth_texture_data = _depth_buffers.find(depth_texture_resource)) {
+			unbind_depth(device, depth_texture_resource, runtimes);
+			depth_texture_data->free_depth_resources(device, _texture_pool, _resource_states);
+			_depth_buffers.erase(depth_texture_resource);
+		}
+	}
+
+	void unbind_depth(device* device, resource depth_texture_resource, const runtime_registry_s::snapshot_s& runtimes) {
+		for (const auto& entry : runtimes.runtimes) {
+			if (entry.runtime->get_device() != device)
+				continue;
+			auto runtime_data = entry.runtime->get_private_data<runtime_data_s>();
+			if (runtime_data->_current_depth_buffer_resource == depth_texture_resource)
+				runtime_data->update_effect_runtime(entry.runtime, { 0 }, { 0 });
+		}
+	}
+
+	// 1 renders at full size, 2, 3 or 4 at half, a third or a quarter of it. ReShade resizes the effect
+	// resources of a runtime whenever the size it renders at changes, so a stream needs an effect runtime
+	// of its own (see bind_stream_runtime) to render at a reduced size.
+	bool set_render_scale(device* device, resource back_buffer_resource, uint32_t scale, const runtime_registry_s::snapshot_s& runtimes) {
+		if (scale < 1 || scale > 4)
+			return false;
+		if (scale > 1 && !has_dedicated_runtime(back_buffer_resource, runtimes))
+			return false;
+
+		watch(back_buffer_resource);
+		publish_watched();
+		auto& back_buffer_data = _back_buffers.emplace(back_buffer_resource);
+		back_buffer_data._scale = scale;
+		if (scale == 1)
+			back_buffer_data.free_scaled(device, _texture_pool, _resource_states);
+		return true;
+	}
+
+	// Like set_render_scale, a non empty rect changes the size the runtime renders at, so it needs an effect
+	// runtime of its own. An empty rect processes the whole target.
+	bool set_render_rect(device* device, resource back_buffer_resource, rect crop, const runtime_registry_s::snapshot_s& runtimes) {
+		const bool has_crop = crop.right > crop.left && crop.bottom > crop.top;
+		if (has_crop && !has_dedicated_runtime(back_buffer_resource, runtimes))
+			return false;
+
+		watch(back_buffer_resource);
+		publish_watched();
+		auto& back_buffer_data = _back_buffers.emplace(back_buffer_resource);
+		back_buffer_data._crop = has_crop ? crop : rect{ 0, 0, 0, 0 };
+		if (!has_crop)
+			back_buffer_data.free_cropped(device, _texture_pool, _resource_states);
+		return true;
+	}
+
+	// Scaled or cropped.
+	bool is_reduced_size(resource back_buffer_resource) {
+		auto back_buffer_data = _back_buffers.find(back_buffer_resource);
+		return back_buffer_data != nullptr && (back_buffer_data->_scale > 1 || back_buffer_data->has_crop());
+	}
+
+	// True if no other stream uses the runtime the stream is bound to.
+	bool has_dedicated_runtime(resource back_buffer_resource, const runtime_registry_s::snapshot_s& runtimes) {
+		if (get_stream_runtime(back_buffer_resource, runtimes) == runtimes.main_runtime)
+			return false;
+
+		const auto binding = *_stream_runtimes.find(back_buffer_resource);
+		bool shared = false;
+		_stream_runtimes.for_each([&](resource other_resource, const runtime_registry_s::entry_s& other_binding) {
+			shared = shared || (other_resource != back_buffer_resource && other_binding.runtime == binding.runtime && other_binding.serial == binding.serial);
+		});
+		return !shared;
+	}
+
+	// Bindings to a runtime that was destroyed since fall back to the main runtime, at full size and uncropped.
+	effect_runtime* get_stream_runtime(resource back_buffer_resource, const runtime_registry_s::snapshot_s& runtimes) {
+		if (auto binding = _stream_runtimes.find(back_buffer_resource)) {
+			auto entry = runtimes.find(binding->runtime);
+			if (entry != nullptr && entry->serial == binding->serial)
+				return binding->runtime;
+			_stream_runtimes.erase(back_buffer_resource);
+			if (auto back_buffer_data = _back_buffers.find(back_buffer_resource)) {
+				// The scaled and cropped textures are freed with the next call.
+				back_buffer_data->_scale = 1;
+				back_buffer_data->_crop = { 0, 0, 0, 0 };
+			}
+		}
+		return runtimes.main_runtime;
+	}
+
+	// Passing a null runtime binds the stream back to the main runtime. Fails if it would make a stream
+	// rendering at a reduced size share its runtime with another one.
+	bool bind_stream_runtime(device* device, resource back_buffer_resource, effect_runtime* runtime, const runtime_registry_s::snapshot_s& runtimes) {
+		if (runtime == nullptr || runtime == runtimes.main_runtime) {
+			if (is_reduced_size(back_buffer_resource))
+				return false;
+			_stream_runtimes.erase(back_buffer_resource);
+			return true;
+		}
+		auto entry = runtimes.find(runtime);
+		if (entry == nullptr || runtime->get_device() != device)
+			return false;
+
+		bool conflict = false;
+		_stream_runtimes.for_each([&](resource other_resource, const runtime_registry_s::entry_s& other_binding) {
+			conflict = conflict || (other_resource != back_buffer_resource && other_binding.runtime == entry->runtime && other_binding.serial == entry->serial
+				&& (is_reduced_size(back_buffer_resource) || is_reduced_size(other_resource)));
+		});
+		if (conflict)
+			return false;
+
+		watch(back_buffer_resource);
+		publish_watched();
+		_stream_runtimes.emplace(back_buffer_resource) = *entry;
+		return true;
+	}
+
+	void free_buffer_resources(device* device, resource back_buffer_resource) {
+		_stream_runtimes.erase(back_buffer_resource);
+		if (auto back_buffer_data = _back_buffers.find(back_buffer_resource)) {
+			back_buffer_data->free_buffer_resources(device, _texture_pool, _resource_states);
+			_back_buffers.erase(back_buffer_resource);
+		}
+		// Outstanding frames of a destroyed target are dropped.
+		if (auto readback = _readbacks.find(back_buffer_resource)) {
+			readback->free(device, _texture_pool, _resource_states);
+			_readbacks.erase(back_buffer_resource);
+		}
+	}
+
+	resource_table_s<readback_ring_s> _readbacks;
+	fence _readback_fence = { 0 };
+	uint64_t _readback_fence_value = 0;
+	bool _readback_fence_failed = false;
+
+	// Passing a null callback drains and removes the ring for the target.
+	bool set_readback(device* device, resource back_buffer_resource, readback_callback_t callback, void* user_data, uint32_t ring_size) {
+		if (auto readback = _readbacks.find(back_buffer_resource)) {
+			readback->drain(device, _readback_fence);
+			readback->free(device, _texture_pool, _resource_states);
+			_readbacks.erase(back_buffer_resource);
+		}
+
+		if (callback == nullptr)
+			return true;
+		if (ring_size == 0)
+			return false;
+
+		watch(back_buffer_resource);
+		publish_watched();
+
+		if (_readback_fence == 0 && !_readback_fence_failed)
+			_readback_fence_failed = !device->create_fence(0, fence_flags::none, &_readback_fence);
+
+		auto& readback = _readbacks.emplace(back_buffer_resource);
+		readback._callback = callback;
+		readback._user_data = user_data;
+		readback._slots.resize(ring_size);
+		return true;
+	}
+
+	pipeline_cache_s _pipelines;
+
+	pipeline get_linear_depth_pipeline(device* device) {
+		return _pipelines.get(device, { pipeline_cache_s::kind_linear_depth, format::r32_float, 1, false });
+	}
+
+	pipeline get_depth_min_max_pipeline(device* device) {
+		return _pipelines.get(device, { pipeline_cache_s::kind_depth_min_max, format::r32g32_float, 1, false });
+	}
+
+	pipeline get_depth_resolve_pipeline(device* device) {
+		return _pipelines.get(device, { pipeline_cache_s::kind_depth_resolve, format::r32_float, 1, false });
+	}
+
+	void on_destroy_device(device* device) {
+		_back_buffers.for_each([&](resource, back_buffer_data_s& back_buffer_data) {
+			back_buffer_data.free_buffer_resources(device, _texture_pool, _resource_states);
+			});
+		_back_buffers.clear();
+		_stream_runtimes.clear();
+		_depth_buffers.for_each([&](resource, depth_texture_data_s& depth_texture_data) {
+			depth_texture_data.free_depth_resources(device, _texture_pool, _resource_states);
+			});
+		_depth_buffers.clear();
+		_readbacks.for_each([&](resource, readback_ring_s& readback) {
+			readback.free(device, _texture_pool, _resource_states);
+			});
+		_readbacks.clear();
+		if (_readback_fence != 0) {
+			device->destroy_fence(_readback_fence);
+			_readback_fence = { 0 };
+		}
+		clear_effect_cache(device);
+		_texture_pool.clear(device);
+		_render_stats.on_destroy_device(device);
+		_trace.stop();
+
+		_pipelines.clear(device);
+
+		_destroyed.clear();
+		delete _watched_published.exchange(nullptr);
+		_watched.clear();
+	}
+
+	struct render_request_s {
+		resource back_buffer_resource;
+		resource depth_buffer_resource;
+		uint64_t content_key; // 0 = don't cache, see render_cached_pass.
+		bool use_technique_mask; // Else the techniques the user enabled run.
+		uint64_t technique_mask;
+		bool result;
+
+		// Filled in by render_effects
+		back_buffer_data_s* back_buffer_data;
+		resource_usage back_buffer_resource_usage;
+		bool has_depth;
+		readback_ring_s* readback;
+		pipeline write_back_pipeline;
+		bool cropped; // Written back by render_cropped already.
+	};
+
+	static trace_writer_s::entry_s get_trace_entry(const render_request_s& request) {
+		return { request.back_buffer_resource, request.result ? request.back_buffer_resource_usage : resource_usage::undefined, request.depth_buffer_resource };
+	}
+
+	std::vector<size_t> _pending_write_backs;
+	std::vector<render_request_s> _batch_requests;
+	std::vector<uint32_t> _batch_entries;
+	std::vector<uint32_t> _batch_pending;
+
+	bool render_effects(device* device, effect_runtime* runtime, resource back_buffer_resource, resource depth_buffer_resource, uint64_t content_key = 0,
+		bool use_technique_mask = false, uint64_t technique_mask = 0) {
+		render_request_s request = { back_buffer_resource, depth_buffer_resource, content_key, use_technique_mask, technique_mask, false, nullptr, resource_usage::undefined, false, nullptr, pipeline{ 0 }, false };
+		return render_effects(device, runtime, &request, 1) && request.result;
+	}
+
+	// Renders effects for several targets in one go. The write-back draws are deferred and
+	// recorded together, so the copy pipeline and sampler only have to be bound once.
+	bool render_effects(device* device, effect_runtime* runtime, render_request_s* requests, size_t count) {
+		auto command_queue = runtime->get_command_queue();
+		if (command_queue == nullptr)
+			return false;
+		auto command_list = command_queue->get_immediate_command_list();
+		if (command_list == nullptr)
+			return false;
+
+		_texture_pool._retired.collect(device);
+
+		// Create all entries first, pointers into the tables are only stable without inserts.
+		for (size_t i = 0; i < count; ++i) {
+			_back_buffers.emplace(requests[i].back_buffer_resource);
+			_depth_buffers.emplace(requests[i].depth_buffer_resource);
+			watch(requests[i].back_buffer_resource);
+			watch(requests[i].depth_buffer_resource);
+		}
+		publish_watched();
+		for (size_t i = 0; i < count; ++i) {
+			requests[i].result = false;
+			requests[i].back_buffer_data = _back_buffers.find(requests[i].back_buffer_resource);
+			requests[i].has_depth = false;
+			requests[i].readback = _readbacks.find(requests[i].back_buffer_resource);
+			requests[i].cropped = false;
+		}
+
+		auto runtime_data = runtime->get_private_data<runtime_data_s>();
+		runtime_data->apply_pending_reload(runtime);
+		if (runtime_data->_camera_serial != _camera_serial) {
+			runtime_data->update_camera(runtime, _camera);
+			runtime_data->_camera_serial = _camera_serial;
+		}
+
+		_render_stats.begin_frame(device, command_queue, command_list);
+		_pending_write_backs.clear();
+		++_render_serial;
+
+		for (size_t i = 0; i < count; ++i) {
+			// A back buffer that is used again has to be written back before it is read again.
+			for (const size_t pending : _pending_write_backs) {
+				if (requests[pending].back_buffer_resource == requests[i].back_buffer_resource) {
+					write_back(device, command_list, requests);
+					break;
+				}
+			}
+
+			if (!render_cached_pass(runtime, command_list, requests[i])) {
+				if (requests[i].use_technique_mask)
+					runtime_data->_techniques.apply_mask(runtime, requests[i].technique_mask);
+				else
+					runtime_data->_techniques.restore(runtime);
+				requests[i].result = render_effects_pass(device, runtime, runtime_data, command_list, requests[i]);
+				if (requests[i].result && requests[i].content_key != 0 && !requests[i].cropped)
+					store_effect_cache(device, runtime, command_list, requests[i]);
+				// The depth texture is free once the effects were recorded, a later request copies into another one.
+				if (requests[i].result && requests[i].has_depth && !requests[i].cropped)
+					rotate_depth_history(device, *requests[i].back_buffer_data, *_depth_buffers.find(requests[i].depth_buffer_resource));
+			}
+
+			if (requests[i].result && requests[i].back_buffer_data->_back_buffer_resolved != 0 && !requests[i].cropped)
+				_pending_write_backs.push_back(i);
+		}
+
+		write_back(device, command_list, requests);
+
+		const bool has_readback = read_back(device, command_list, requests, count);
+
+		// After the write-backs and read backs, only the last result for a target in this call is kept.
+		for (size_t i = 0; i < count; ++i) {
+			if (!requests[i].result || requests[i].cropped)
+				continue;
+			bool used_again = false;
+			for (size_t j = i + 1; j < count; ++j)
+				used_again |= requests[j].result && requests[j].back_buffer_data == requests[i].back_buffer_data;
+			if (!used_again)
+				rotate_color_history(device, *requests[i].back_buffer_data);
+		}
+
+		// Hand HLAE's resources back in the state they came in.
+		for (size_t i = 0; i < count; ++i) {
+			if (!requests[i].result)
+				continue;
+			_resource_states.transition(requests[i].back_buffer_resource, requests[i].back_buffer_resource_usage);
+			if (requests[i].has_depth)
+				_resource_states.transition(requests[i].depth_buffer_resource, resource_usage::depth_stencil);
+		}
+		_resource_states.flush(command_list);
+
+		for (size_t i = 0; i < count; ++i) {
+			_resource_states.forget(requests[i].back_buffer_resource);
+			_resource_states.forget(requests[i].depth_buffer_resource);
+		}
+
+		_render_stats.end_stage(command_list, render_stats_s::stage_write_back);
+		_render_stats.end_frame();
+
+		// The readback copies have to be submitted for the fence to cover them.
+		if (has_readback && _readback_fence != 0) {
+			command_queue->flush_immediate_command_list();
+			command_queue->signal(_readback_fence, ++_readback_fence_value);
+		}
+		_texture_pool._retired.signal(command_queue);
+
+		return true;
+	}
+
+	// Copies the processed targets of requests that have a readback ring into the next staging texture.
+	bool read_back(device* device, command_list* command_list, render_request_s* requests, size_t count) {
+		bool has_readback = false;
+
+		for (size_t i = 0; i < count; ++i) {
+			if (requests[i].cropped)
+				requests[i].readback = nullptr;
+			if (!requests[i].result || requests[i].readback == nullptr)
+				continue;
+
+			// Only the last result for a target in this batch is read back.
+			bool used_again = false;
+			for (size_t j = i + 1; j < count; ++j)
+				used_again |= requests[j].result && requests[j].readback == requests[i].readback;
+			if (used_again) {
+				requests[i].readback = nullptr;
+				continue;
+			}
+
+			const auto& back_buffer_data = *requests[i].back_buffer_data;
+			const bool has_resolved = back_buffer_data._back_buffer_resolved != 0;
+			const resource source = has_resolved ? back_buffer_data._back_buffer_resolved : requests[i].back_buffer_resource;
+			const format source_format = has_resolved ? format_to_typeless(back_buffer_data._back_buffer_format) : back_buffer_data._back_buffer_desc.texture.format;
+
+			auto slot = requests[i].readback->prepare_slot(device, _readback_fence, _texture_pool, _resource_states,
+				back_buffer_data._width, back_buffer_data._height, source_format, back_buffer_data._back_buffer_format);
+			if (slot == nullptr) {
+				requests[i].readback = nullptr;
+				continue;
+			}
+
+			_resource_states.transition(source, resource_usage::copy_source);
+			_resource_states.transition(slot->staging, resource_usage::copy_dest);
+			has_readback = true;
+		}
+
+		if (!has_readback)
+			return false;
+
+		_resource_states.flush(command_list);
+
+		for (size_t i = 0; i < count; ++i) {
+			if (!requests[i].result || requests[i].readback == nullptr)
+				continue;
+
+			const auto& back_buffer_data = *requests[i].back_buffer_data;
+			const resource source = back_buffer_data._back_buffer_resolved != 0 ? back_buffer_data._back_buffer_resolved : requests[i].back_buffer_resource;
+
+			auto& readback = *requests[i].readback;
+			command_list->copy_texture_region(source, 0, nullptr, readback._slots[readback._next].staging, 0, nullptr);
+			readback.commit_slot(_readback_fence_value + 1);
+		}
+
+		return true;
+	}
+
+	// The image effects leave for write_back / read_back: the resolve texture if there is one, else the back buffer.
+	static resource get_processed_image(const render_request_s& request, format* out_format) {
+		const auto& back_buffer_data = *request.back_buffer_data;
+		if (back_buffer_data._back_buffer_resolved != 0) {
+			*out_format = format_to_typeless(back_buffer_data._back_buffer_format);
+			return back_buffer_data._back_buffer_resolved;
+		}
+		*out_format = back_buffer_data._back_buffer_desc.texture.format;
+		return request.back_buffer_resource;
+	}
+
+	effect_cache_entry_s* find_effect_cache(effect_runtime* runtime, const render_request_s& request, format format) {
+		const auto& back_buffer_data = *request.back_buffer_data;
+		for (auto& entry : _effect_cache) {
+			if (entry.content_key == request.content_key
+				&& entry.runtime == runtime
+				&& entry.use_technique_mask == request.use_technique_mask
+				&& entry.technique_mask == request.technique_mask
+				&& entry.depth_buffer_resource == request.depth_buffer_resource
+				&& entry.width == back_buffer_data._width
+				&& entry.height == back_buffer_data._height
+				&& entry.scale == back_buffer_data._scale
+				&& entry.texture_format == format)
+				return &entry;
+		}
+		return nullptr;
+	}
+
+	// Copies the cached image for a keyed request into its target, returns false if there is none.
+	// Not used with history frames: the image depends on the stream's own COLOR_PREV / DEPTH_PREV, and
+	// a skipped pass would leave its rings out of step.
+	bool render_cached_pass(effect_runtime* runtime, command_list* command_list, render_request_s& request) {
+		if (request.content_key == 0 || _effect_cache.empty() || _history_frames != 0)
+			return false;
+
+		auto& back_buffer_data = *request.back_buffer_data;
+		rect crop;
+		if (!back_buffer_data._hasBackBuffer || back_buffer_data.get_crop_rect(&crop))
+			return false;
+
+		format format;
+		const resource target = get_processed_image(request, &format);
+		const auto entry = find_effect_cache(runtime, request, format);
+		if (entry == nullptr)
+			return false;
+
+		request.back_buffer_resource_usage = back_buffer_data._back_buffer_resolved != 0 ? resource_usage::present : back_buffer_data._back_buffer_desc.usage;
+		_resource_states.track(request.back_buffer_resource, request.back_buffer_resource_usage);
+
+		_resource_states.transition(entry->texture, resource_usage::copy_source);
+		_resource_states.transition(target, resource_usage::copy_dest);
+		_resource_states.flush(command_list);
+
+		command_list->copy_texture_region(entry->texture, 0, nullptr, target, 0, nullptr);
+		_render_stats.end_stage(command_list, render_stats_s::stage_effects);
+
+		request.result = true;
+		return true;
+	}
+
+	void store_effect_cache(device* device, effect_runtime* runtime, command_list* command_list, const render_request_s& request) {
+		if (_history_frames != 0)
+			return;
+
+		format format;
+		const resource source = get_processed_image(request, &format);
+		if (find_effect_cache(runtime, request, format) != nullptr)
+			return;
+
+		const auto& back_buffer_data = *request.back_buffer_data;
+		effect_cache_entry_s entry = { request.content_key, runtime, request.use_technique_mask, request.technique_mask, request.depth_buffer_resource, back_buffer_data._width, back_buffer_data._height, back_buffer_data._scale, format, resource{ 0 } };
+		resource_usage state;
+		if (!_texture_pool.acquire(device, texture_pool_s::key_s{ entry.width, entry.height, format, 1, resource_usage::copy_dest | resource_usage::copy_source },
+			resource_usage::copy_dest, "ReShade advancedfx effect cache", &entry.texture, &state))
+			return;
+		_resource_states.set_state(entry.texture, state);
+
+		_resource_states.transition(source, resource_usage::copy_source);
+		_resource_states.transition(entry.texture, resource_usage::copy_dest);
+		_resource_states.flush(command_list);
+
+		command_list->copy_texture_region(source, 0, nullptr, entry.texture, 0, nullptr);
+		_effect_cache.push_back(entry);
+	}
+
+	// Resolve / copy in, depth and effect pass for one request, the write-back is done by write_back.
+	bool render_effects_pass(device* device, effect_runtime* runtime, runtime_data_s* runtime_data, command_list* command_list, render_request_s& request) {
+		auto& back_buffer_data = *request.back_buffer_data;
+		const resource back_buffer_resource = request.back_buffer_resource;
+		const resource depth_buffer_resource = request.depth_buffer_resource;
+
+		// Reduced size rendering draws from and into the resolve texture, so it needs the copy pipeline.
+		const bool has_crop = back_buffer_data.has_crop();
+		const bool want_scaled = back_buffer_data._scale > 1 && !has_crop && pipeline_cache_s::is_supported(device, pipeline_cache_s::kind_copy);
+
+		if (!back_buffer_data.ensure_buffers(device, _texture_pool, _resource_states, back_buffer_resource, needs_resolve(device, back_buffer_data)))
+			return false;
+		ensure_history(device, back_buffer_data);
+
+		auto& depth_buffer_data = *_depth_buffers.find(depth_buffer_resource);
+
+		const bool has_resolved = back_buffer_data._back_buffer_resolved != 0;
+
+		// A multisampled target is still resolved whole (partial resolves aren't available everywhere),
+		// its region is copied from the resolve texture and has to be drawn back.
+		rect crop_rect = {};
+		const pipeline crop_write_back_pipeline = has_crop ? get_write_back_pipeline(device, back_buffer_data) : pipeline{ 0 };
+		bool cropped = has_crop
+			&& back_buffer_data.get_crop_rect(&crop_rect)
+			&& (back_buffer_data._back_buffer_samples == 1 || (has_resolved && crop_write_back_pipeline != 0))
+			&& back_buffer_data.ensure_cropped(device, _texture_pool, _resource_states, crop_rect.right - crop_rect.left, crop_rect.bottom - crop_rect.top);
+		if (!cropped)
+			back_buffer_data.free_cropped(device, _texture_pool, _resource_states);
+
+		const bool scaled = want_scaled
+			&& has_resolved
+			&& back_buffer_data._back_buffer_resolved_srv != 0
+			&& get_copy_pipeline(device, format_to_default_typed(back_buffer_data._back_buffer_format, 0), 1) != 0
+			&& back_buffer_data.ensure_scaled(device, _texture_pool, _resource_states);
+		if (!scaled)
+			back_buffer_data.free_scaled(device, _texture_pool, _resource_states);
+
+		// HLAE's resources are expected in these states and have to be returned in them.
+		request.back_buffer_resource_usage = back_buffer_data._hlae_state;
+		_resource_states.track(back_buffer_resource, request.back_buffer_resource_usage);
+
+		const bool has_depth = depth_buffer_data.supply_depth(device, _texture_pool, _resource_states, depth_buffer_resource, allows_direct_depth_binding(), get_depth_resolve_pipeline(device) != 0);
+		const bool resolve_depth = has_depth && depth_buffer_data._depth_ms_srv != 0;
+		const bool copy_depth = has_depth && depth_buffer_data._depth_texture != 0 && !resolve_depth;
+		// Depth is cropped by drawing it, without that the target is processed whole.
+		if (cropped && has_depth
+			&& !(get_copy_pipeline(device, format::r32_float, 1) != 0
+				&& depth_buffer_data.ensure_scaled_depth(device, _texture_pool, _resource_states, back_buffer_data._crop_width, back_buffer_data._crop_height))) {
+			cropped = false;
+			back_buffer_data.free_cropped(device, _texture_pool, _resource_states);
+		}
+		request.cropped = cropped;
+		const bool linear_depth = has_depth
+			&& !cropped
+			&& _depth_near_plane != _depth_far_plane
+			&& get_linear_depth_pipeline(device) != 0
+			&& get_depth_min_max_pipeline(device) != 0
+			&& depth_buffer_data.ensure_linear_depth(device, _texture_pool, _resource_states);
+		const bool scaled_depth = scaled && has_depth
+			&& get_copy_pipeline(device, format::r32_float, 1) != 0
+			&& depth_buffer_data.ensure_scaled_depth(device, _texture_pool, _resource_states, back_buffer_data._scaled_width, back_buffer_data._scaled_height);
+		request.has_depth = has_depth;
+		if (has_depth) {
+			_resource_states.track(depth_buffer_resource, resource_usage::depth_stencil);
+
+			const resource_view depth_view = scaled_depth || cropped ? depth_buffer_data._scaled_depth_srv : depth_buffer_data._depth_texture_view;
+			const resource_view linear_depth_view = linear_depth ? depth_buffer_data._linear_depth_srv : resource_view{ 0 };
+			const resource_view depth_mips_view = linear_depth ? depth_buffer_data._depth_mips_srv : resource_view{ 0 };
+			if (!runtime_data->is_current(depth_buffer_resource, depth_view, linear_depth_view, depth_mips_view)) {
+				update_dependent_effect_runtime(runtime, depth_buffer_resource, depth_view, linear_depth_view, depth_mips_view);
+			}
+		}
+		if (runtime_data->_current_depth_near_plane != _depth_near_plane || runtime_data->_current_depth_far_plane != _depth_far_plane) {
+			runtime_data->_current_depth_near_plane = _depth_near_plane;
+			runtime_data->_current_depth_far_plane = _depth_far_plane;
+			runtime_data->update_effect_runtime(runtime);
+		}
+		if (_history_frames != 0)
+			bind_history(runtime, runtime_data, back_buffer_data, cropped);
+
+		// Resolve MSAA back buffer if MSAA is active or copy when format conversion is required
+		const bool resolve_whole = has_resolved && !(cropped && back_buffer_data._back_buffer_samples == 1);
+		if (resolve_whole)
+		{
+			if (back_buffer_data._back_buffer_samples == 1)
+			{
+				_resource_states.transition(back_buffer_resource, resource_usage::copy_source);
+				_resource_states.transition(back_buffer_data._back_buffer_resolved, resource_usage::copy_dest);
+			}
+			else
+			{
+				_resource_states.transition(back_buffer_resource, resource_usage::resolve_source);
+				_resource_states.transition(back_buffer_data._back_buffer_resolved, resource_usage::resolve_dest);
+			}
+		}
+		if (copy_depth)
+		{
+			_resource_states.transition(depth_buffer_resource, resource_usage::copy_source);
+			_resource_states.transition(depth_buffer_data._depth_texture, resource_usage::copy_dest);
+		}
+		_resource_states.flush(command_list);
+
+		if (resolve_whole)
+		{
+			if (back_buffer_data._back_buffer_samples == 1)
+				command_list->copy_texture_region(back_buffer_resource, 0, nullptr, back_buffer_data._back_buffer_resolved, 0, nullptr);
+			else
+				command_list->resolve_texture_region(back_buffer_resource, 0, nullptr, back_buffer_data._back_buffer_resolved, 0, 0, 0, 0, back_buffer_data._back_buffer_format);
+		}
+		_render_stats.end_stage(command_list, render_stats_s::stage_resolve);
+		if (copy_depth)
+		{
+			command_list->copy_texture_region(depth_buffer_resource, 0, nullptr, depth_buffer_data._depth_texture, 0, nullptr);
+		}
+		if (resolve_depth)
+		{
+			render_depth_resolve(device, command_list, depth_buffer_resource, depth_buffer_data);
+		}
+		if (linear_depth && depth_buffer_data._linear_depth_serial != _render_serial)
+		{
+			render_linear_depth(device, command_list, depth_buffer_resource, depth_buffer_data);
+			depth_buffer_data._linear_depth_serial = _render_serial;
+		}
+		_render_stats.end_stage(command_list, render_stats_s::stage_depth);
+
+		if (cropped)
+			return render_cropped(device, runtime, command_list, request, crop_rect, crop_write_back_pipeline, has_depth ? &depth_buffer_data : nullptr);
+		if (scaled)
+			return render_scaled(device, runtime, command_list, depth_buffer_resource, back_buffer_data, scaled_depth ? &depth_buffer_data : nullptr);
+
+		// Effect pass
+		if (has_resolved)
+			_resource_states.transition(back_buffer_data._back_buffer_resolved, resource_usage::render_target);
+		else
+			_resource_states.transition(back_buffer_resource, resource_usage::render_target);
+		if (copy_depth || resolve_depth)
+		{
+			_resource_states.transition(depth_buffer_data._depth_texture, resource_usage::shader_resource);
+			_resource_states.transition(depth_buffer_resource, resource_usage::depth_stencil);
+		}
+		else if (has_depth)
+		{
+			_resource_states.transition(depth_buffer_resource, resource_usage::shader_resource);
+		}
+		_resource_states.flush(command_list);
+
+		if (has_resolved)
+			runtime->render_effects(command_list, back_buffer_data._back_buffer_revoled_targets[0], back_buffer_data._back_buffer_revoled_targets[1]);
+		else
+			runtime->render_effects(command_list, back_buffer_data._back_buffer_targets[0], back_buffer_data._back_buffer_targets[1]);
+		_render_stats.end_stage(command_list, render_stats_s::stage_effects);
+
+		return true;
+	}
+
+	// Reduced size rendering draws from and into the resolve texture, so it needs the copy pipeline.
+	static bool wants_scaled(device* device, const back_buffer_data_s& back_buffer_data) {
+		return back_buffer_data._scale > 1 && !back_buffer_data.has_crop() && pipeline_cache_s::is_supported(device, pipeline_cache_s::kind_copy);
+	}
+
+	// The history ring is filled with resolve textures, which effects can only sample with the copy pipeline.
+	bool wants_history(device* device, const back_buffer_data_s& back_buffer_data) const {
+		return _history_frames != 0 && !back_buffer_data.has_crop() && pipeline_cache_s::is_supported(device, pipeline_cache_s::kind_copy);
+	}
+
+	bool needs_resolve(device* device, const back_buffer_data_s& back_buffer_data) const {
+		return wants_scaled(device, back_buffer_data) || wants_history(device, back_buffer_data);
+	}
+
+	bool allows_direct_depth_binding() const {
+		return _direct_depth_binding && _history_frames == 0;
+	}
+
+	void ensure_history(device* device, back_buffer_data_s& back_buffer_data) {
+		if (back_buffer_data._color_history.size() == _history_frames)
+			return;
+		back_buffer_data.free_history(device, _texture_pool, _resource_states);
+		back_buffer_data._color_history.resize(_history_frames);
+		back_buffer_data._depth_history.resize(_history_frames);
+	}
+
+	// Binds the stream's previous frames, a cropped pass gets none.
+	void bind_history(effect_runtime* runtime, runtime_data_s* runtime_data, const back_buffer_data_s& back_buffer_data, bool cropped) {
+		resource_view color_views[runtime_data_s::max_history_frames] = {};
+		resource_view depth_views[runtime_data_s::max_history_frames] = {};
+		for (size_t i = 0; !cropped && i < back_buffer_data._color_history.size(); ++i) {
+			const auto& color = back_buffer_data._color_history[i];
+			if (color.srv != 0) {
+				color_views[i] = color.srv;
+				_resource_states.transition(color.texture, resource_usage::shader_resource);
+			}
+			const auto& depth = back_buffer_data._depth_history[i];
+			if (depth.srv != 0) {
+				depth_views[i] = depth.srv;
+				_resource_states.transition(depth.texture, resource_usage::shader_resource);
+			}
+		}
+		runtime_data->update_history(runtime, color_views, depth_views);
+	}
+
+	// The resolve texture holding the processed image becomes the newest entry of the ring and the
+	// oldest entry's texture is resolved into next time, nothing is copied.
+	void rotate_color_history(device* device, back_buffer_data_s& back_buffer_data) {
+		auto& history = back_buffer_data._color_history;
+		if (history.empty() || back_buffer_data._back_buffer_resolved == 0 || back_buffer_data._back_buffer_resolved_srv == 0)
+			return;
+
+		const back_buffer_data_s::history_color_s oldest = history.back();
+		history.pop_back();
+		history.insert(history.begin(), { back_buffer_data._back_buffer_resolved, back_buffer_data._back_buffer_resolved_srv,
+			{ back_buffer_data._back_buffer_revoled_targets[0], back_buffer_data._back_buffer_revoled_targets[1] } });
+
+		// The entries are dropped with the resolve texture, so they always match it.
+		back_buffer_data._back_buffer_resolved = oldest.texture;
+		back_buffer_data._back_buffer_resolved_srv = oldest.srv;
+		back_buffer_data._back_buffer_revoled_targets[0] = oldest.targets[0];
+		back_buffer_data._back_buffer_revoled_targets[1] = oldest.targets[1];
+		if (back_buffer_data._back_buffer_resolved == 0 && !back_buffer_data.create_resolve_texture(device, _texture_pool, _resource_states))
+			back_buffer_data.free_buffer_resources(device, _texture_pool, _resource_states);
+	}
+
+	// Same for the depth texture, the oldest entry only takes its place if it was made from a depth
+	// buffer like this one. Streams sharing the depth buffer in a call copy into the replacement.
+	void rotate_depth_history(device* device, back_buffer_data_s& back_buffer_data, depth_texture_data_s& depth_buffer_data) {
+		auto& history = back_buffer_data._depth_history;
+		if (history.empty() || depth_buffer_data._depth_texture == 0)
+			return;
+
+		back_buffer_data_s::history_depth_s oldest = history.back();
+		history.pop_back();
+		history.insert(history.begin(), { depth_buffer_data._depth_texture, depth_buffer_data._depth_texture_view,
+			depth_buffer_data._depth_texture_rtv, depth_buffer_data._depth_desc });
+
+		const resource_desc& desc = depth_buffer_data._depth_desc;
+		if (oldest.texture != 0
+			&& oldest.desc.texture.width == desc.texture.width && oldest.desc.texture.height == desc.texture.height
+			&& oldest.desc.texture.format == desc.texture.format && oldest.desc.texture.samples == desc.texture.samples) {
+			depth_buffer_data._depth_texture = oldest.texture;
+			depth_buffer_data._depth_texture_view = oldest.srv;
+			depth_buffer_data._depth_texture_rtv = oldest.rtv;
+			return;
+		}
+
+		back_buffer_data_s::free_history_depth(device, _texture_pool, _resource_states, oldest);
+		depth_buffer_data._depth_texture = { 0 };
+		depth_buffer_data._depth_texture_view = { 0 };
+		depth_buffer_data._depth_texture_rtv = { 0 };
+		if (!depth_buffer_data.create_depth_texture(device, _texture_pool, _resource_states))
+			depth_buffer_data.free_depth_resources(device, _texture_pool, _resource_states);
+	}
+
+	pipeline get_copy_pipeline(device* device, format target_format, uint16_t samples) {
+		return _pipelines.get(device, { pipeline_cache_s::kind_copy, target_format, samples, format_to_default_typed(target_format, 1) == target_format });
+	}
+
+	// Draws source over the whole of target with the copy pipeline, stretching it if the sizes differ.
+	void draw_copy(device* device, command_list* command_list, resource_view source, resource_view target, format target_format, uint32_t width, uint32_t height, bool linear) {
+		const viewport viewport = { 0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f };
+		const rect scissor_rect = { 0, 0, static_cast<int32_t>(width), static_cast<int32_t>(height) };
+		draw_copy(device, command_list, source, target, get_copy_pipeline(device, target_format, 1), viewport, scissor_rect, linear);
+	}
+
+	// Draws source stretched over viewport, the parts of it outside of target or scissor_rect are cut off.
+	void draw_copy(device* device, command_list* command_list, resource_view source, resource_view target, pipeline copy_pipeline, const viewport& viewport, const rect& scissor_rect, bool linear) {
+		const pipeline_layout layout = _pipelines.get_layout(device, pipeline_cache_s::kind_copy);
+		const sampler sampler = _pipelines.get_sampler(device, linear);
+
+		command_list->bind_pipeline(pipeline_stage::all_graphics, copy_pipeline);
+		command_list->push_descriptors(shader_stage::pixel, layout, 0, descriptor_table_update{ {}, 0, 0, 1, descriptor_type::sampler, &sampler });
+		command_list->push_descriptors(shader_stage::pixel, layout, 1, descriptor_table_update{ {}, 0, 0, 1, descriptor_type::shader_resource_view, &source });
+
+		command_list->bind_viewports(0, 1, &viewport);
+		command_list->bind_scissor_rects(0, 1, &scissor_rect);
+
+		command_list->bind_render_targets_and_depth_stencil(1, &target);
+		command_list->draw(3, 1, 0, 0);
+	}
+
+	// Copy pipeline drawing into the back buffer in its own format and sample count, 0 if there is none.
+	pipeline get_write_back_pipeline(device* device, const back_buffer_data_s& back_buffer_data) {
+		if (_pipelines.get_sampler(device, false) == 0)
+			return { 0 };
+		const bool srgb_write_enable = (back_buffer_data._back_buffer_format == format::r8g8b8a8_unorm_srgb || back_buffer_data._back_buffer_format == format::b8g8r8a8_unorm_srgb);
+		// Keyed by the format of _back_buffer_targets, which stay X8 where _back_buffer_format became A8.
+		return _pipelines.get(device, {
+			pipeline_cache_s::kind_copy, format_to_default_typed(back_buffer_data._back_buffer_desc.texture.format, srgb_write_enable ? 1 : 0), back_buffer_data._back_buffer_samples, srgb_write_enable });
+	}
+
+	// Copies crop_rect of the target (or of the resolve texture for multisampled targets) into the crop
+	// texture, crops the depth the same way, runs the effects there and writes the region straight back.
+	bool render_cropped(device* device, effect_runtime* runtime, command_list* command_list, render_request_s& request, const rect& crop_rect,
+		pipeline write_back_pipeline, depth_texture_data_s* depth_buffer_data) {
+		auto& back_buffer_data = *request.back_buffer_data;
+		const resource back_buffer_resource = request.back_buffer_resource;
+		const resource depth_buffer_resource = request.depth_buffer_resource;
+		const uint32_t width = back_buffer_data._crop_width;
+		const uint32_t height = back_buffer_data._crop_height;
+		const subresource_box box = { crop_rect.left, crop_rect.top, 0, crop_rect.right, crop_rect.bottom, 1 };
+		const resource source = back_buffer_data._back_buffer_samples > 1 ? back_buffer_data._back_buffer_resolved : back_buffer_resource;
+		const resource depth_source = depth_buffer_data && depth_buffer_data->_depth_texture != 0 ? depth_buffer_data->_depth_texture : depth_buffer_resource;
+
+		_resource_states.transition(source, resource_usage::copy_source);
+		_resource_states.transition(back_buffer_data._crop_texture, resource_usage::copy_dest);
+		if (depth_buffer_data) {
+			_resource_states.transition(depth_source, resource_usage::shader_resource);
+			_resource_states.transition(depth_buffer_data->_scaled_depth_texture, resource_usage::render_target);
+		}
+		_resource_states.flush(command_list);
+
+		command_list->copy_texture_region(source, 0, &box, back_buffer_data._crop_texture, 0, nullptr);
+		if (depth_buffer_data) {
+			// The whole depth stretched over the target, offset so the region lands in the crop texture.
+			const viewport depth_viewport = { -static_cast<float>(crop_rect.left), -static_cast<float>(crop_rect.top), static_cast<float>(back_buffer_data._width), static_cast<float>(back_buffer_data._height), 0.0f, 1.0f };
+			const rect depth_scissor_rect = { 0, 0, static_cast<int32_t>(width), static_cast<int32_t>(height) };
+			draw_copy(device, command_list, depth_buffer_data->_depth_texture_view, depth_buffer_data->_scaled_depth_rtv, get_copy_pipeline(device, format::r32_float, 1), depth_viewport, depth_scissor_rect, false);
+		}
+
+		_resource_states.transition(back_buffer_data._crop_texture, resource_usage::render_target);
+		if (depth_buffer_data) {
+			_resource_states.transition(depth_buffer_data->_scaled_depth_texture, resource_usage::shader_resource);
+			if (depth_buffer_data->_depth_texture != 0)
+				_resource_states.transition(depth_buffer_resource, resource_usage::depth_stencil);
+		}
+		_resource_states.flush(command_list);
+
+		runtime->render_effects(command_list, back_buffer_data._crop_targets[0], back_buffer_data._crop_targets[1]);
+		_render_stats.end_stage(command_list, render_stats_s::stage_effects);
+
+		if (write_back_pipeline != 0) {
+			_resource_states.transition(back_buffer_data._crop_texture, resource_usage::shader_resource);
+			_resource_states.transition(back_buffer_resource, resource_usage::render_target);
+			_resource_states.flush(command_list);
+
+			const bool srgb_write_enable = (back_buffer_data._back_buffer_format == format::r8g8b8a8_unorm_srgb || back_buffer_data._back_buffer_format == format::b8g8r8a8_unorm_srgb);
+			const viewport viewport = { static_cast<float>(crop_rect.left), static_cast<float>(crop_rect.top), static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f };
+			draw_copy(device, command_list, back_buffer_data._crop_srv, back_buffer_data._back_buffer_targets[srgb_write_enable ? 1 : 0], write_back_pipeline, viewport, crop_rect, false);
+		}
+		else {
+			_resource_states.transition(back_buffer_data._crop_texture, resource_usage::copy_source);
+			_resource_states.transition(back_buffer_resource, resource_usage::copy_dest);
+			_resource_states.flush(command_list);
+
+			command_list->copy_texture_region(back_buffer_data._crop_texture, 0, nullptr, back_buffer_resource, 0, &box);
+		}
+
+		return true;
+	}
+
+	// Downsamples the resolved back buffer (and depth) into the scaled textures, runs the effects there and
+	// upsamples the result back into the resolve texture, from where write_back takes it as usual.
+	bool render_scaled(device* device, effect_runtime* runtime, command_list* command_list, resource depth_buffer_resource, back_buffer_data_s& back_buffer_data, depth_texture_data_s* depth_buffer_data) {
+		const uint32_t width = back_buffer_data._scaled_width;
+		const uint32_t height = back_buffer_data._scaled_height;
+
+		_resource_states.transition(back_buffer_data._back_buffer_resolved, resource_usage::shader_resource);
+		_resource_states.transition(back_buffer_data._scaled_texture, resource_usage::render_target);
+		if (depth_buffer_data) {
+			const resource depth_source = depth_buffer_data->_depth_texture != 0 ? depth_buffer_data->_depth_texture : depth_buffer_resource;
+			_resource_states.transition(depth_source, resource_usage::shader_resource);
+			_resource_states.transition(depth_buffer_data->_scaled_depth_texture, resource_usage::render_target);
+		}
+		_resource_states.flush(command_list);
+
+		draw_copy(device, command_list, back_buffer_data._back_buffer_resolved_srv, back_buffer_data._scaled_targets[0], format_to_default_typed(back_buffer_data._back_buffer_format, 0), width, height, true);
+		if (depth_buffer_data)
+			draw_copy(device, command_list, depth_buffer_data->_depth_texture_view, depth_buffer_data->_scaled_depth_rtv, format::r32_float, width, height, false);
+
+		if (depth_buffer_data) {
+			_resource_states.transition(depth_buffer_data->_scaled_depth_texture, resource_usage::shader_resource);
+			if (depth_buffer_data->_depth_texture != 0)
+				_resource_states.transition(depth_buffer_resource, resource_usage::depth_stencil);
+		}
+		_resource_states.flush(command_list);
+
+		runtime->render_effects(command_list, back_buffer_data._scaled_targets[0], back_buffer_data._scaled_targets[1]);
+		_render_stats.end_stage(command_list, render_stats_s::stage_effects);
+
+		_resource_states.transition(back_buffer_data._scaled_texture, resource_usage::shader_resource);
+		_resource_states.transition(back_buffer_data._back_buffer_resolved, resource_usage::render_target);
+		_resource_states.flush(command_list);
+
+		draw_copy(device, command_list, back_buffer_data._scaled_srv, back_buffer_data._back_buffer_revoled_targets[0], format_to_default_typed(back_buffer_data._back_buffer_format, 0), back_buffer_data._width, back_buffer_data._height, true);
+
+		return true;
+	}
+
+	void render_depth_resolve(device* device, command_list* command_list, resource depth_buffer_resource, depth_texture_data_s& depth_buffer_data) {
+		_resource_states.transition(depth_buffer_resource, resource_usage::shader_resource);
+		_resource_states.transition(depth_buffer_data._depth_texture, resource_usage::render_target);
+		_resource_states.flush(command_list);
+
+		const uint32_t width = depth_buffer_data._depth_desc.texture.width;
+		const uint32_t height = depth_buffer_data._depth_desc.texture.height;
+
+		const pipeline_layout layout = _pipelines.get_layout(device, pipeline_cache_s::kind_depth_resolve);
+		command_list->bind_pipeline(pipeline_stage::all_graphics, get_depth_resolve_pipeline(device));
+		command_list->push_constants(shader_stage::pixel, layout, 0, 0, 1, &_depth_resolve_mode);
+		command_list->push_descriptors(shader_stage::pixel, layout, 1, descriptor_table_update{ {}, 0, 0, 1, descriptor_type::shader_resource_view, &depth_buffer_data._depth_ms_srv });
+
+		const viewport depth_viewport = { 0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f };
+		command_list->bind_viewports(0, 1, &depth_viewport);
+		const rect depth_scissor_rect = { 0, 0, static_cast<int32_t>(width), static_cast<int32_t>(height) };
+		command_list->bind_scissor_rects(0, 1, &depth_scissor_rect);
+
+		command_list->bind_render_targets_and_depth_stencil(1, &depth_buffer_data._depth_texture_rtv);
+		command_list->draw(3, 1, 0, 0);
+
+		_resource_states.transition(depth_buffer_data._depth_texture, resource_usage::shader_resource);
+		_resource_states.flush(command_list);
+	}
+
+	// Writes linear depth into DEPTH_LINEAR and level 0 of DEPTH_MIPS, then reduces each level of
+	// DEPTH_MIPS into the next, so depth based effects don't each linearize / downsample on their own.
+	void render_linear_depth(device* device, command_list* command_list, resource depth_buffer_resource, depth_texture_data_s& depth_buffer_data) {
+		_resource_states.transition(depth_buffer_data._depth_texture != 0 ? depth_buffer_data._depth_texture : depth_buffer_resource, resource_usage::shader_resource);
+		_resource_states.transition(depth_buffer_data._linear_depth_texture, resource_usage::render_target);
+		_resource_states.transition(depth_buffer_data._depth_mips_texture, resource_usage::render_target);
+		_resource_states.flush(command_list);
+
+		const uint32_t width = depth_buffer_data._depth_desc.texture.width;
+		const uint32_t height = depth_buffer_data._depth_desc.texture.height;
+		const float depth_range[2] = { _depth_near_plane, _depth_far_plane };
+
+		const pipeline_layout linear_layout = _pipelines.get_layout(device, pipeline_cache_s::kind_linear_depth);
+		command_list->bind_pipeline(pipeline_stage::all_graphics, get_linear_depth_pipeline(device));
+		command_list->push_constants(shader_stage::pixel, linear_layout, 0, 0, 2, depth_range);
+		command_list->push_descriptors(shader_stage::pixel, linear_layout, 1, descriptor_table_update{ {}, 0, 0, 1, descriptor_type::shader_resource_view, &depth_buffer_data._depth_texture_view });
+
+		const viewport depth_viewport = { 0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f };
+		command_list->bind_viewports(0, 1, &depth_viewport);
+		const rect depth_scissor_rect = { 0, 0, static_cast<int32_t>(width), static_cast<int32_t>(height) };
+		command_list->bind_scissor_rects(0, 1, &depth_scissor_rect);
+
+		const resource_view targets[2] = { depth_buffer_data._linear_depth_rtv, depth_buffer_data._depth_mips_level_rtvs[0] };
+		command_list->bind_render_targets_and_depth_stencil(2, targets);
+		command_list->draw(3, 1, 0, 0);
+
+		const pipeline_layout min_max_layout = _pipelines.get_layout(device, pipeline_cache_s::kind_depth_min_max);
+		command_list->bind_pipeline(pipeline_stage::all_graphics, get_depth_min_max_pipeline(device));
+		for (size_t level = 1; level < depth_buffer_data._depth_mips_level_rtvs.size(); ++level) {
+			const uint32_t level_width = std::max(1u, width >> level);
+			const uint32_t level_height = std::max(1u, height >> level);
+
+			// Unbind the previous level as target before reading from it.
+			command_list->bind_render_targets_and_depth_stencil(1, &depth_buffer_data._depth_mips_level_rtvs[level]);
+			command_list->push_descriptors(shader_stage::pixel, min_max_layout, 0, descriptor_table_update{ {}, 0, 0, 1, descriptor_type::shader_resource_view, &depth_buffer_data._depth_mips_level_srvs[level - 1] });
+
+			const viewport level_viewport = { 0.0f, 0.0f, static_cast<float>(level_width), static_cast<float>(level_height), 0.0f, 1.0f };
+			command_list->bind_viewports(0, 1, &level_viewport);
+			const rect level_scissor_rect = { 0, 0, static_cast<int32_t>(level_width), static_cast<int32_t>(level_height) };
+			command_list->bind_scissor_rects(0, 1, &level_scissor_rect);
+
+			command_list->draw(3, 1, 0, 0);
+		}
+
+		_resource_states.transition(depth_buffer_data._linear_depth_texture, resource_usage::shader_resource);
+		_resource_states.transition(depth_buffer_data._depth_mips_texture, resource_usage::shader_resource);
+		_resource_states.flush(command_list);
+	}
+
+	// Stretch main render target back into MSAA back buffer if MSAA is active or copy when format conversion is required
+	void write_back(device* device, command_list* command_list, render_request_s* requests) {
+		if (_pending_write_backs.empty())
+			return;
+
+		// Draw into the back buffer where a copy pipeline for it exists, else copy (requires compatible formats).
+		const sampler point_sampler = _pipelines.get_sampler(device, false);
+		for (const size_t i : _pending_write_backs) {
+			auto& request = requests[i];
+			request.write_back_pipeline = get_write_back_pipeline(device, *request.back_buffer_data);
+
+			const bool use_copy_pipeline = request.write_back_pipeline != 0;
+			_resource_states.transition(request.back_buffer_resource, use_copy_pipeline ? resource_usage::render_target : resource_usage::copy_dest);
+			_resource_states.transition(request.back_buffer_data->_back_buffer_resolved, use_copy_pipeline ? resource_usage::shader_resource : resource_usage::copy_source);
+		}
+		_resource_states.flush(command_list);
+
+		const pipeline_layout copy_layout = _pipelines.get_layout(device, pipeline_cache_s::kind_copy);
+		pipeline bound_pipeline = { 0 };
+
+		for (const size_t i : _pending_write_backs) {
+			const auto& request = requests[i];
+			const auto& back_buffer_data = *request.back_buffer_data;
+
+			if (request.write_back_pipeline != 0)
+			{
+				// Targets of the same format share the pipeline binding.
+				if (request.write_back_pipeline != bound_pipeline) {
+					bound_pipeline = request.write_back_pipeline;
+					command_list->bind_pipeline(pipeline_stage::all_graphics, bound_pipeline);
+					command_list->push_descriptors(shader_stage::pixel, copy_layout, 0, descriptor_table_update{ {}, 0, 0, 1, descriptor_type::sampler, &point_sampler });
+				}
+				command_list->push_descriptors(shader_stage::pixel, copy_layout, 1, descriptor_table_update{ {}, 0, 0, 1, descriptor_type::shader_resource_view, &back_buffer_data._back_buffer_resolved_srv });
+
+				const viewport viewport = { 0.0f, 0.0f, static_cast<float>(back_buffer_data._width), static_cast<float>(back_buffer_data._height), 0.0f, 1.0f };
+				command_list->bind_viewports(0, 1, &viewport);
+				const rect scissor_rect = { 0, 0, static_cast<int32_t>(back_buffer_data._width), static_cast<int32_t>(back_buffer_data._height) };
+				command_list->bind_scissor_rects(0, 1, &scissor_rect);
+
+				const bool srgb_write_enable = (back_buffer_data._back_buffer_format == format::r8g8b8a8_unorm_srgb || back_buffer_data._back_buffer_format == format::b8g8r8a8_unorm_srgb);
+				command_list->bind_render_targets_and_depth_stencil(1, &back_buffer_data._back_buffer_targets[srgb_write_enable?1:0]);
+
+				command_list->draw(3, 1, 0, 0);
+			}
+			else
+			{
+				command_list->copy_texture_region(back_buffer_data._back_buffer_resolved, 0, nullptr, request.back_buffer_resource, 0, nullptr);
+			}
+		}
+
+		_pending_write_backs.clear();
+		_render_stats.end_stage(command_list, render_stats_s::stage_write_back);
+	}
+};
+
+// Held by each of HLAE's calls: the read section of the runtime registry keeps the runtimes it uses
+// from being destroyed under it, and the call section keeps on_destroy_resource out of the device's
+// tables. Applies what ReShade's events left for the call.
+struct hlae_call_s
+{
+	epoch_guard_s _runtimes_guard;
+	const runtime_registry_s::snapshot_s* const runtimes;
+	device* const main_device; // Of the main runtime, null if there is none yet.
+	device_data_s::call_section_s _call_section;
+
+	explicit hlae_call_s(runtime_registry_s& registry)
+		: _runtimes_guard(registry._epochs)
+		, runtimes(registry.get())
+		, main_device(runtimes != nullptr && runtimes->main_runtime != nullptr ? runtimes->main_runtime->get_device() : nullptr)
+		, _call_section(main_device != nullptr ? main_device->get_private_data<device_data_s>() : nullptr) {
+		if (main_device != nullptr)
+			main_device->get_private_data<device_data_s>()->begin_hlae_call(main_device, *runtimes);
+	}
+
+	hlae_call_s(const hlae_call_s&) = delete;
+	hlae_call_s& operator=(const hlae_call_s&) = delete;
+};
+
+struct replay_stats_s {
+	uint32_t calls = 0;
+	uint64_t captured_cpu_time_ns = 0; // Sum of the call times recorded in the trace.
+	uint64_t cpu_time_ns = 0;
+	uint64_t max_call_cpu_time_ns = 0;
+	uint64_t textures_created = 0;     // Texture pool misses.
+	uint64_t textures_reused = 0;      // Texture pool hits.
+	uint64_t textures_evicted = 0;
+	uint64_t maps = 0;                 // Readback frames mapped.
+};
+
+// Called for each replayed render call with the time it took when captured and in the replay.
+typedef void (*replay_call_callback_t)(void* user_data, uint32_t call, uint64_t captured_cpu_time_ns, uint64_t cpu_time_ns);
+
+inline void count_replay_readback(void* user_data, uint64_t, const void*, uint32_t, uint32_t, uint32_t, uint32_t) {
+	++static_cast<replay_stats_s*>(user_data)->maps;
+}
+
+// Replays a trace written by trace_writer_s with runtime, on a stand-in device (see tests/trace_replay.cpp)
+// rather than the game's: the traced resources are recreated from their descs when first rendered, in
+// the state they were handed in then, and the calls are made in order, without waiting between them.
+inline bool replay_trace(device* device, effect_runtime* runtime, const char* path, replay_stats_s* stats, replay_call_callback_t callback, void* user_data) {
+	auto device_data = device->get_private_data<device_data_s>();
+	auto runtime_data = runtime->get_private_data<runtime_data_s>();
+	if (path == nullptr || stats == nullptr || device_data == nullptr || runtime_data == nullptr)
+		return false;
+	if (device_data->_trace.is_active())
+		return false; // Don't trace the replay.
+
+	trace_reader_s reader;
+	if (!reader.open(path))
+		return false;
+
+	// The stand-in device has no other runtimes and no other threads.
+	runtime_registry_s::snapshot_s runtimes;
+	runtimes.main_runtime = runtime;
+	runtimes.runtimes.push_back({ runtime, 1 });
+
+	*stats = {};
+	const auto& texture_pool = device_data->_texture_pool;
+	const uint64_t hits = texture_pool._hits, misses = texture_pool._misses, evictions = texture_pool._evictions;
+
+	struct replay_resource_s {
+		resource_desc desc;
+		resource texture;
+		uint32_t readback_ring_size; // Of a readback set before the target was rendered.
+	};
+	std::map<uint32_t, replay_resource_s> resources;
+	const auto destroy = [&](std::map<uint32_t, replay_resource_s>::iterator it) {
+		if (it->second.texture != 0) {
+			device_data->set_readback(device, it->second.texture, nullptr, nullptr, 0);
+			device_data->free_resource(device, it->second.texture, runtimes);
+			device_data->publish_watched();
+			device_data->_texture_pool._retired.retire(device, it->second.texture);
+		}
+		resources.erase(it);
+	};
+	const auto get = [&](uint32_t id, resource_usage state) {
+		auto it = resources.find(id);
+		if (it == resources.end())
+			return resource{ 0 };
+		auto& traced = it->second;
+		if (traced.texture == 0 && device->create_resource(traced.desc, nullptr, state, &traced.texture) && traced.readback_ring_size != 0)
+			device_data->set_readback(device, traced.texture, count_replay_readback, stats, traced.readback_ring_size);
+		return traced.texture;
+	};
+
+	bool result = true;
+	uint8_t type;
+	uint64_t time;
+	while (result && reader.get(type) && reader.get(time)) {
+		switch (type) {
+		case trace_format_s::record_resource: {
+			uint32_t id, width, height, format, usage;
+			uint16_t levels, samples;
+			result = reader.get(id) && reader.get(width) && reader.get(height) && reader.get(levels) && reader.get(format) && reader.get(samples) && reader.get(usage);
+			if (!result)
+				break;
+
+			auto it = resources.find(id);
+			if (it != resources.end())
+				destroy(it);
+			resources[id] = { resource_desc(width, height, 1, levels, static_cast<reshade::api::format>(format), samples, memory_heap::gpu_only, static_cast<resource_usage>(usage)), { 0 }, 0 };
+			break;
+		}
+		case trace_format_s::record_render: {
+			uint32_t count;
+			result = reader.get(count);
+
+			auto& requests = device_data->_batch_requests;
+			requests.clear();
+			for (uint32_t i = 0; result && i < count; ++i) {
+				uint32_t back_buffer_id, back_buffer_state, depth_id;
+				result = reader.get(back_buffer_id) && reader.get(back_buffer_state) && reader.get(depth_id);
+				// Targets the captured call failed for are left out, their state isn't known.
+				if (!result || static_cast<resource_usage>(back_buffer_state) == resource_usage::undefined)
+					continue;
+				const resource back_buffer_resource = get(back_buffer_id, static_cast<resource_usage>(back_buffer_state));
+				if (back_buffer_resource != 0)
+					requests.push_back({ back_buffer_resource, get(depth_id, resource_usage::depth_stencil), 0, false, 0, false, nullptr, resource_usage::undefined, false, nullptr, pipeline{ 0 }, false });
+			}
+			uint64_t captured_duration;
+			result = result && reader.get(captured_duration);
+			if (!result)
+				break;
+
+			const auto start = std::chrono::steady_clock::now();
+			runtime_data->begin_hlae_effects(runtime);
+			device_data->render_effects(device, runtime, requests.data(), requests.size());
+			runtime_data->end_hlae_effects(runtime);
+			const uint64_t duration = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+			if (callback)
+				callback(user_data, stats->calls, captured_duration, duration);
+			++stats->calls;
+			stats->captured_cpu_time_ns += captured_duration;
+			stats->cpu_time_ns += duration;
+			stats->max_call_cpu_time_ns = std::max(stats->max_call_cpu_time_ns, duration);
+			break;
+		}
+		case trace_format_s::record_destroy: {
+			uint32_t id;
+			result = reader.get(id);
+			auto it = result ? resources.find(id) : resources.end();
+			if (it != resources.end())
+				destroy(it);
+			break;
+		}
+		case trace_format_s::record_readback: {
+			uint32_t id, ring_size;
+			result = reader.get(id) && reader.get(ring_size);
+			auto it = result ? resources.find(id) : resources.end();
+			if (it == resources.end())
+				break;
+			if (it->second.texture != 0)
+				device_data->set_readback(device, it->second.texture, ring_size != 0 ? count_replay_readback : nullptr, stats, ring_size);
+			else
+				it->second.readback_ring_size = ring_size;
+			break;
+		}
+		default:
+			result = false;
+			break;
+		}
+	}
+
+	while (!resources.empty())
+		destroy(resources.begin());
+
+	stats->textures_created = texture_pool._misses - misses;
+	stats->textures_reused = texture_pool._hits - hits;
+	stats->textures_evicted = texture_pool._evictions - evictions;
+	return result;
+}
@@ -2,21 +2,10 @@
 
 #include <imgui.h>
 #include <reshade.hpp>
-#include <reshade_api_device.hpp>
-#include <vector>
-#include <queue>
-#include <map>
-#include <set>
+#include "advancedfx_core.hpp"
 
 HMODULE g_hReShadeModule = nullptr;
-#define IDR_COPY_PS                     101
-#define IDR_FULLSCREEN_VS               102
-
-struct data_resource
-{
-	size_t data_size;
-	const void* data;
-};
+HMODULE g_hModule = nullptr;
 
 data_resource load_data_resource(HMODULE module_handke, unsigned short id)
 {
@@ -31,460 +20,458 @@ data_resource load_data_resource(HMODULE module_handke, unsigned short id)
 	return result;
 }
 
-using namespace reshade::api;
+data_resource load_data_resource(unsigned short id)
+{
+	return load_data_resource(g_hReShadeModule, id);
+}
+
+data_resource load_addon_data_resource(unsigned short id)
+{
+	return load_data_resource(g_hModule, id);
+}
 
-void update_dependent_effect_runtime(effect_runtime* runtime, resource depth_buffer_resource, resource_view rsv);
+runtime_registry_s g_Runtimes;
 
-struct cmp_resource {
-	bool operator()(const resource& a, const resource& b) const {
-		return a.handle < b.handle;
-	}
-};
+static void on_reshade_reloaded_effects(effect_runtime* runtime) {
+	auto data = runtime->get_private_data<runtime_data_s>();
+	data->_reload_pending = true;
+}
 
+static bool render_effects(void* pRenderTargetView, void* pDepthTextureResource, uint64_t contentKey, bool useTechniqueMask, uint64_t techniqueMask) {
 
-struct __declspec(uuid("9A609C4B-75C6-47C5-AFB5-4C65E0807F69")) runtime_data_s
-{
-	bool block_effects = true;
-	bool effects_were_enabled = true;
-	resource _current_depth_buffer_resource = { 0 };
-	resource_view _current_depth_texture_view = { 0 };
-
-	void update_effect_runtime(effect_runtime* runtime) const {
-		runtime->update_texture_bindings("DEPTH", _current_depth_texture_view, _current_depth_texture_view);
-
-		runtime->enumerate_uniform_variables(nullptr, [this](effect_runtime* runtime, auto variable) {
-			char source[32] = "";
-			if (runtime->get_annotation_string_from_uniform_variable(variable, "source", source) && std::strcmp(source, "bufready_depth") == 0)
-				runtime->set_uniform_value_bool(variable, _current_depth_texture_view != 0);
-			});
-	}
+	hlae_call_s call(g_Runtimes);
+	const auto runtimes = call.runtimes;
+	auto device = call.main_device;
+	if (device == 0)
+		return false;
 
-	void update_effect_runtime(effect_runtime* runtime, resource depth_buffer_resource, resource_view depth_texture_view) {
-		_current_depth_buffer_resource = depth_buffer_resource;
-		_current_depth_texture_view = depth_texture_view;
-		this->update_effect_runtime(runtime);
+	if (pRenderTargetView == 0) {
+		// HLAE wants us to render no effects.
+		runtimes->main_runtime->get_private_data<runtime_data_s>()->skip_hlae_effects(runtimes->main_runtime);
+		return true;
 	}
-};
 
-struct __declspec(uuid("4F2FCBC8-D459-4325-A4D8-4EE63F5C4571")) device_data_s
-{
-	struct back_buffer_data_s {
-		bool _hasBackBuffer = false;
-		resource_desc _back_buffer_desc;
-		uint32_t _width;
-		uint32_t _height;
-		format _back_buffer_format;
-		uint16_t _back_buffer_samples;
-		resource _back_buffer_resolved = { 0 };
-		resource_view _back_buffer_resolved_srv = {};
-		std::vector<resource_view> _back_buffer_targets;
-		std::vector<resource_view> _back_buffer_revoled_targets;
-
-		void free_buffer_resources(device* device) {
-			if (_hasBackBuffer) {
-				for (const auto view : _back_buffer_revoled_targets)
-					device->destroy_resource_view(view);
-				_back_buffer_revoled_targets.clear();
-
-
-				device->destroy_resource(_back_buffer_resolved);
-				_back_buffer_resolved = {};
-				device->destroy_resource_view(_back_buffer_resolved_srv);
-				_back_buffer_resolved_srv = {};
-
-				for (const auto view : _back_buffer_targets)
-					device->destroy_resource_view(view);
-				_back_buffer_targets.clear();
-
-				_hasBackBuffer = false;
-			}
-		}
+	auto device_data = device->get_private_data<device_data_s>();
 
-		bool ensure_buffers(device* device, resource back_buffer_resource) {
-			const resource_desc back_buffer_desc = device->get_resource_desc(back_buffer_resource);
-
-			if (!_hasBackBuffer
-				|| back_buffer_desc.flags != _back_buffer_desc.flags
-				|| back_buffer_desc.heap != _back_buffer_desc.heap
-				|| back_buffer_desc.texture.depth_or_layers != _back_buffer_desc.texture.depth_or_layers
-				|| back_buffer_desc.texture.format != _back_buffer_desc.texture.format
-				|| back_buffer_desc.texture.height != _back_buffer_desc.texture.height
-				|| back_buffer_desc.texture.levels != _back_buffer_desc.texture.levels
-				|| back_buffer_desc.texture.samples != _back_buffer_desc.texture.samples
-				|| back_buffer_desc.texture.width != _back_buffer_desc.texture.width
-				|| back_buffer_desc.type != _back_buffer_desc.type
-				|| back_buffer_desc.usage != _back_buffer_desc.usage
-				) {
-				if (_hasBackBuffer) {
-					free_buffer_resources(device);
-				}
+	resource back_buffer_resource{ (uint64_t)pRenderTargetView };
+	resource depth_buffer_resouce{ (uint64_t)pDepthTextureResource };
 
-				_back_buffer_desc = back_buffer_desc;
+	auto runtime = device_data->get_stream_runtime(back_buffer_resource, *runtimes);
+	auto runtime_data = runtime->get_private_data<runtime_data_s>();
 
-				_width = back_buffer_desc.texture.width;
-				_height = back_buffer_desc.texture.height;
-				_back_buffer_format = format_to_default_typed(back_buffer_desc.texture.format);
-				_back_buffer_samples = back_buffer_desc.texture.samples;
+	const uint64_t trace_time = device_data->_trace.is_active() ? device_data->_trace.now() : 0;
 
-				// Create resolve texture and copy pipeline (do this before creating effect resources, to ensure correct back buffer format is set up)
-				if (back_buffer_desc.texture.samples > 1
-					// Some effects rely on there being an alpha channel available, so create resolve texture if that is not the case
-					|| (_back_buffer_format == format::r8g8b8x8_unorm || _back_buffer_format == format::b8g8r8x8_unorm
-						|| _back_buffer_format == format::r8g8b8x8_unorm_srgb || _back_buffer_format == format::b8g8r8x8_unorm_srgb)
-					)
-				{
-					switch (_back_buffer_format)
-					{
-					case format::r8g8b8x8_unorm:
-					case format::r8g8b8x8_unorm_srgb:
-						_back_buffer_format = format::r8g8b8a8_unorm;
-						break;
-					case format::b8g8r8x8_unorm:
-					case format::b8g8r8x8_unorm_srgb:
-						_back_buffer_format = format::b8g8r8a8_unorm;
-						break;
-					}
-
-					const bool need_copy_pipeline =
-						device->get_api() == device_api::d3d10 ||
-						device->get_api() == device_api::d3d11 ||
-						device->get_api() == device_api::d3d12;
-
-					resource_usage usage = resource_usage::render_target | resource_usage::copy_dest | resource_usage::resolve_dest;
-					if (need_copy_pipeline)
-						usage |= resource_usage::shader_resource;
-					else
-						usage |= resource_usage::copy_source;
-
-					if (!device->create_resource(
-						resource_desc(_width, _height, 1, 1, format_to_typeless(_back_buffer_format), 1, memory_heap::gpu_only, usage),
-						nullptr, back_buffer_desc.texture.samples == 1 ? resource_usage::copy_dest : resource_usage::resolve_dest, &_back_buffer_resolved) ||
-						!device->create_resource_view(
-							_back_buffer_resolved,
-							resource_usage::render_target,
-							resource_view_desc(format_to_default_typed(_back_buffer_format, 0)),
-							&_back_buffer_revoled_targets.emplace_back()) ||
-						!device->create_resource_view(
-							_back_buffer_resolved,
-							resource_usage::render_target,
-							resource_view_desc(format_to_default_typed(_back_buffer_format, 1)),
-							&_back_buffer_revoled_targets.emplace_back())) {
-						free_buffer_resources(device);
-						return false;
-					}
-
-					if (need_copy_pipeline)
-					{
-						if (!device->create_resource_view(
-							_back_buffer_resolved,
-							resource_usage::shader_resource,
-							resource_view_desc(_back_buffer_format),
-							&_back_buffer_resolved_srv))
-						{
-							free_buffer_resources(device);
-							return false;
-						}
-					}
-				}
-				// Create render targets for the back buffer resources
-				if (!device->create_resource_view(
-					back_buffer_resource,
-					resource_usage::render_target,
-					resource_view_desc(
-						back_buffer_desc.texture.samples > 1 ? resource_view_type::texture_2d_multisample : resource_view_type::texture_2d,
-						format_to_default_typed(back_buffer_desc.texture.format, 0), 0, 1, 0, 1),
-					&_back_buffer_targets.emplace_back()) ||
-					!device->create_resource_view(
-						back_buffer_resource,
-						resource_usage::render_target,
-						resource_view_desc(
-							back_buffer_desc.texture.samples > 1 ? resource_view_type::texture_2d_multisample : resource_view_type::texture_2d,
-							format_to_default_typed(back_buffer_desc.texture.format, 1), 0, 1, 0, 1),
-						&_back_buffer_targets.emplace_back()))
-				{
-					free_buffer_resources(device);
-					return false;
-				}
+	device_data_s::render_request_s request = { back_buffer_resource, depth_buffer_resouce, contentKey, useTechniqueMask, techniqueMask, false, nullptr, resource_usage::undefined, false, nullptr, pipeline{ 0 }, false };
+	runtime_data->begin_hlae_effects(runtime);
+	auto result = device_data->render_effects(device, runtime, &request, 1) && request.result;
+	runtime_data->end_hlae_effects(runtime);
 
-				_hasBackBuffer = true;
-			}
+	if (device_data->_trace.is_active()) {
+		const auto entry = device_data_s::get_trace_entry(request);
+		device_data->_trace.write_render(device, &entry, 1, trace_time, device_data->_trace.now() - trace_time);
+	}
+	return result;
+}
 
-			return _hasBackBuffer;
-		}
-	};
+extern "C" bool __declspec(dllexport) AdvancedfxRenderEffects(void* pRenderTargetView, void * pDepthTextureResource) {
+	return render_effects(pRenderTargetView, pDepthTextureResource, 0, false, 0);
+}
 
-	struct depth_texture_data_s {
-		resource _depth_texture = { 0 };
-		resource_view _depth_texture_view = { 0 };
+// Same as AdvancedfxRenderEffects, but a call with a non 0 contentKey (for example HLAE's frame index
+// combined with a stream group id) that was already rendered with the same depth buffer and target
+// size / format in this frame copies that result instead of running the effects again. Keys are
+// ignored with HistoryFrames set, since each stream's result depends on its own previous frames.
+extern "C" bool __declspec(dllexport) AdvancedfxRenderEffectsKeyed(void* pRenderTargetView, void* pDepthTextureResource, uint64_t contentKey) {
+	return render_effects(pRenderTargetView, pDepthTextureResource, contentKey, false, 0);
+}
 
-		void free_depth_resources(device* device) {
-			if (_depth_texture_view != 0) {
-				device->destroy_resource_view(_depth_texture_view);
-				_depth_texture_view = { 0 };
-			}
-			if (_depth_texture != 0) {
-				device->destroy_resource(_depth_texture);
-				_depth_texture = { 0 };
-			}
-		}
+// Same as AdvancedfxRenderEffects, but only the techniques with their bit set in techniqueMask run,
+// bit i standing for technique i of AdvancedfxGetTechniqueName (techniques past 64 keep their state).
+// Only techniques that differ from the previous call are switched, so changing the set per stream
+// doesn't reload effects. The next unmasked call restores the techniques the user enabled.
+extern "C" bool __declspec(dllexport) AdvancedfxRenderEffectsMasked(void* pRenderTargetView, void* pDepthTextureResource, uint64_t techniqueMask) {
+	return render_effects(pRenderTargetView, pDepthTextureResource, 0, true, techniqueMask);
+}
 
-		bool supply_depth(device * device, resource depth_texture_resource) {
-			if (depth_texture_resource == 0) {
-				free_depth_resources(device);
-				return false;
-			}
+// Gets the name of technique index of pRuntime (null for the main runtime) into pName, a nameSize
+// bytes buffer. Returns false past the last technique. The order changes when effects are reloaded.
+extern "C" bool __declspec(dllexport) AdvancedfxGetTechniqueName(void* pRuntime, uint32_t index, char* pName, uint32_t nameSize) {
 
-			const resource_desc rs_depth_desc(device->get_resource_desc(depth_texture_resource));
-			const resource_desc rs_depth_target_desc(_depth_texture != 0 ? device->get_resource_desc(_depth_texture) : resource_desc());
+	hlae_call_s call(g_Runtimes);
+	const auto runtimes = call.runtimes;
+	auto device = call.main_device;
+	if (device == 0 || pName == 0 || nameSize == 0)
+		return false;
 
-			if (_depth_texture != 0 && (rs_depth_desc.texture.width != rs_depth_target_desc.texture.width || rs_depth_desc.texture.height != rs_depth_desc.texture.height)) {
-				free_depth_resources(device);
-			}
+	auto runtime = pRuntime != 0 ? static_cast<effect_runtime*>(pRuntime) : runtimes->main_runtime;
+	if (runtimes->find(runtime) == nullptr)
+		return false;
 
-			if (_depth_texture == 0) {
-				resource_desc desc(rs_depth_desc);
-				if (desc.texture.samples == 1) // we always expect a resolved depth buffer from HLAE (otherwise we would need to resolve it ourselves with shaders)
-				{
-					desc.type = resource_type::texture_2d;
-					desc.heap = memory_heap::gpu_only;
-					desc.usage = resource_usage::shader_resource | resource_usage::copy_dest;
-					//desc.texture.format = format::r32_float;
-
-					if (device->create_resource(desc, nullptr, resource_usage::copy_dest, &_depth_texture))
-						device->set_resource_name(_depth_texture, "ReShade advancedfx depth texture");
-					else
-						return false;
-
-					resource_view_desc view_desc(format_to_default_typed(desc.texture.format));
-					if (!device->create_resource_view(_depth_texture, resource_usage::shader_resource, view_desc, &_depth_texture_view))
-						return false;
-				}
-			}
-			if (_depth_texture == 0
-				|| _depth_texture_view == 0)
-				return false;
+	auto runtime_data = runtime->get_private_data<runtime_data_s>();
+	runtime_data->apply_pending_reload(runtime);
 
-			return true;
-		}
-	};
-
-	std::map<resource, back_buffer_data_s, cmp_resource> _back_buffers;
-	std::map<resource, depth_texture_data_s, cmp_resource> _depth_buffers;
-	std::set<effect_runtime*> _effect_runtimes;
-
-	void free_depth_resources(device* device, resource depth_texture_resource) {
-		auto it = _depth_buffers.find(depth_texture_resource);
-		if (it != _depth_buffers.end()) {
-			for (auto it2 = _effect_runtimes.begin(); it2 != _effect_runtimes.end(); it2++) {
-				auto runtime_data = (*it2)->get_private_data<runtime_data_s>();
-				if (runtime_data->_current_depth_buffer_resource == depth_texture_resource)
-					runtime_data->update_effect_runtime(*it2, { 0 }, { 0 });
-			}
+	const auto& techniques = runtime_data->_techniques.get(runtime);
+	if (index >= techniques.size())
+		return false;
 
-			auto& depth_texture_data = it->second;
-			device->destroy_resource_view(depth_texture_data._depth_texture_view);
-			device->destroy_resource(depth_texture_data._depth_texture);
+	std::snprintf(pName, nameSize, "%s", techniques[index].name.c_str());
+	return true;
+}
 
-			_depth_buffers.erase(it);
-		}
-	}
+struct AdvancedfxRenderEffectsBatchEntry {
+	void* pRenderTargetView;
+	void* pDepthTextureResource;
+	bool Result; // Set by AdvancedfxRenderEffectsBatch.
+};
 
-	void free_buffer_resources(device* device, resource back_buffer_resource) {
-		auto it = _back_buffers.find(back_buffer_resource);
-		if (it != _back_buffers.end()) {
-			it->second.free_buffer_resources(device);
-			_back_buffers.erase(it);
-		}
-	}
+// Same as calling AdvancedfxRenderEffects for each entry, but the per call setup and the
+// write-back pipeline binding are shared between entries bound to the same effect runtime.
+extern "C" bool __declspec(dllexport) AdvancedfxRenderEffectsBatch(AdvancedfxRenderEffectsBatchEntry* pEntries, uint32_t count) {
 
-	pipeline _copy_pipeline = {};
-	pipeline_layout _copy_pipeline_layout = {};
-	sampler  _copy_sampler_state = {};
+	if (pEntries == 0 && count != 0)
+		return false;
 
-	void on_init_device(device* device) {
-		sampler_desc sampler_desc = {};
-		sampler_desc.filter = filter_mode::min_mag_mip_point;
-		sampler_desc.address_u = texture_address_mode::clamp;
-		sampler_desc.address_v = texture_address_mode::clamp;
-		sampler_desc.address_w = texture_address_mode::clamp;
+	for (uint32_t i = 0; i < count; ++i)
+		pEntries[i].Result = false;
 
-		pipeline_layout_param layout_params[2];
-		layout_params[0] = descriptor_range{ 0, 0, 0, 1, shader_stage::all, 1, descriptor_type::sampler };
-		layout_params[1] = descriptor_range{ 0, 0, 0, 1, shader_stage::all, 1, descriptor_type::shader_resource_view };
+	hlae_call_s call(g_Runtimes);
+	const auto runtimes = call.runtimes;
+	auto device = call.main_device;
+	if (device == 0)
+		return false;
 
-		const data_resource vs = load_data_resource(g_hReShadeModule,IDR_FULLSCREEN_VS);
-		const data_resource ps = load_data_resource(g_hReShadeModule,IDR_COPY_PS);
+	auto device_data = device->get_private_data<device_data_s>();
 
-		shader_desc vs_desc = { vs.data, vs.data_size };
-		shader_desc ps_desc = { ps.data, ps.data_size };
+	auto& pending = device_data->_batch_pending;
+	pending.clear();
+	for (uint32_t i = 0; i < count; ++i) {
+		if (pEntries[i].pRenderTargetView != 0)
+			pending.push_back(i);
+	}
 
-		std::vector<pipeline_subobject> subobjects;
-		subobjects.push_back({ pipeline_subobject_type::vertex_shader, 1, &vs_desc });
-		subobjects.push_back({ pipeline_subobject_type::pixel_shader, 1, &ps_desc });
+	const uint64_t trace_time = device_data->_trace.is_active() ? device_data->_trace.now() : 0;
+	device_data->_trace_entries.clear();
+
+	bool result = true;
+	auto& requests = device_data->_batch_requests;
+	auto& entries = device_data->_batch_entries;
+	while (!pending.empty()) {
+		// Take all entries bound to the runtime of the first pending one, keep the rest in order.
+		auto runtime = device_data->get_stream_runtime(resource{ (uint64_t)pEntries[pending[0]].pRenderTargetView }, *runtimes);
+
+		requests.clear();
+		entries.clear();
+		size_t remaining = 0;
+		for (auto i : pending) {
+			resource back_buffer_resource{ (uint64_t)pEntries[i].pRenderTargetView };
+			if (device_data->get_stream_runtime(back_buffer_resource, *runtimes) != runtime) {
+				pending[remaining++] = i;
+				continue;
+			}
+			requests.push_back({ back_buffer_resource, resource{ (uint64_t)pEntries[i].pDepthTextureResource }, 0, false, 0, false, nullptr, resource_usage::undefined, false, nullptr, pipeline{ 0 }, false });
+			entries.push_back(i);
+		}
+		pending.resize(remaining);
 
-		if (!device->create_pipeline_layout(2, layout_params, &_copy_pipeline_layout) ||
-			!device->create_pipeline(_copy_pipeline_layout, static_cast<uint32_t>(subobjects.size()), subobjects.data(), &_copy_pipeline) ||
-			!device->create_sampler(sampler_desc, &_copy_sampler_state))
-		{
-			
+		auto runtime_data = runtime->get_private_data<runtime_data_s>();
+		runtime_data->begin_hlae_effects(runtime);
+		result = device_data->render_effects(device, runtime, requests.data(), requests.size()) && result;
+		runtime_data->end_hlae_effects(runtime);
+
+		for (size_t j = 0; j < entries.size(); ++j) {
+			pEntries[entries[j]].Result = requests[j].result;
+			if (device_data->_trace.is_active())
+				device_data->_trace_entries.push_back(device_data_s::get_trace_entry(requests[j]));
 		}
 	}
 
-	void on_destroy_device(device* device) {
-		device->destroy_pipeline(_copy_pipeline);
-		_copy_pipeline = {};
-		device->destroy_pipeline_layout(_copy_pipeline_layout);
-		_copy_pipeline_layout = {};
-		device->destroy_sampler(_copy_sampler_state);
-		_copy_sampler_state = {};
-	}
+	if (device_data->_trace.is_active())
+		device_data->_trace.write_render(device, device_data->_trace_entries.data(), device_data->_trace_entries.size(), trace_time, device_data->_trace.now() - trace_time);
 
-	bool render_effects(device* device, effect_runtime* runtime, resource back_buffer_resource, resource depth_buffer_resource) {
-		auto& back_buffer_data = _back_buffers.emplace(std::piecewise_construct, std::forward_as_tuple(back_buffer_resource), std::forward_as_tuple()).first->second;
-		auto& depth_buffer_data = _depth_buffers.emplace(std::piecewise_construct, std::forward_as_tuple(depth_buffer_resource), std::forward_as_tuple()).first->second;
+	return result;
+}
 
-		if (!back_buffer_data.ensure_buffers(device, back_buffer_resource))
-			return false;
+// Renders the effects for pRenderTargetView at 1 / scale of its size (scale 1 to 4, 1 = full size) and
+// upscales the result, for cheap previews. ReShade resizes its effect resources whenever the size
+// it renders at changes, so a scale above 1 fails unless pRenderTargetView is bound to an effect
+// runtime of its own with AdvancedfxBindEffectRuntime, and it is kept for the stream.
+extern "C" bool __declspec(dllexport) AdvancedfxSetRenderScale(void* pRenderTargetView, uint32_t scale) {
 
-		auto runtime_data = runtime->get_private_data<runtime_data_s>();
-		auto old_back_buffer_resource_usage = device->get_resource_desc(back_buffer_resource).usage;
+	hlae_call_s call(g_Runtimes);
+	const auto runtimes = call.runtimes;
+	auto device = call.main_device;
+	if (device == 0 || pRenderTargetView == 0)
+		return false;
 
-		if (auto command_queue = runtime->get_command_queue()) {
-			if (auto command_list = command_queue->get_immediate_command_list()) {
+	auto device_data = device->get_private_data<device_data_s>();
+	return device_data->set_render_scale(device, resource{ (uint64_t)pRenderTargetView }, scale, *runtimes);
+}
 
-				// Resolve MSAA back buffer if MSAA is active or copy when format conversion is required
-				if (back_buffer_data._back_buffer_resolved != 0)
-				{
-					if (back_buffer_data._back_buffer_samples == 1)
-					{
-						command_list->barrier(back_buffer_resource, resource_usage::present, resource_usage::copy_source);
-						command_list->copy_texture_region(back_buffer_resource, 0, nullptr, back_buffer_data._back_buffer_resolved, 0, nullptr);
-						command_list->barrier(back_buffer_data._back_buffer_resolved, resource_usage::copy_dest, resource_usage::render_target);
-					}
-					else
-					{
-						command_list->barrier(back_buffer_resource, resource_usage::present, resource_usage::resolve_source);
-						command_list->resolve_texture_region(back_buffer_resource, 0, nullptr, back_buffer_data._back_buffer_resolved, 0, 0, 0, 0, back_buffer_data._back_buffer_format);
-						command_list->barrier(back_buffer_data._back_buffer_resolved, resource_usage::resolve_dest, resource_usage::render_target);
-					}
-				}
+// Limits the effects on pRenderTargetView to the rectangle from left, top to right, bottom (exclusive),
+// for picture in picture insets or cropped streams: only that part is copied, processed and written
+// back, at a cost that scales with its area. An empty rectangle (all 0) processes the whole target
+// again. Cropped targets ignore the render scale and aren't read back or cached. Like a render scale,
+// a rectangle fails unless pRenderTargetView is bound to an effect runtime of its own.
+extern "C" bool __declspec(dllexport) AdvancedfxSetRenderRect(void* pRenderTargetView, int32_t left, int32_t top, int32_t right, int32_t bottom) {
+
+	hlae_call_s call(g_Runtimes);
+	const auto runtimes = call.runtimes;
+	auto device = call.main_device;
+	if (device == 0 || pRenderTargetView == 0)
+		return false;
 
-				if (depth_buffer_data.supply_depth(device, depth_buffer_resource)) {
-					if (runtime_data->_current_depth_buffer_resource != depth_buffer_resource || runtime_data->_current_depth_texture_view != depth_buffer_data._depth_texture_view) {
-						update_dependent_effect_runtime(runtime, depth_buffer_resource, depth_buffer_data._depth_texture_view);
-					}
+	auto device_data = device->get_private_data<device_data_s>();
+	return device_data->set_render_rect(device, resource{ (uint64_t)pRenderTargetView }, rect{ left, top, right, bottom }, *runtimes);
+}
 
-					command_list->barrier(depth_buffer_resource, resource_usage::depth_stencil, resource_usage::copy_source);
-					command_list->copy_texture_region(depth_buffer_resource, 0, nullptr, depth_buffer_data._depth_texture, 0, nullptr);
-					command_list->barrier(depth_buffer_data._depth_texture, resource_usage::copy_dest, resource_usage::shader_resource);
-				}
+// Enumerates the effect runtimes of the main runtime's device, the first one is the main runtime.
+// Call with ppRuntimes null to query the count.
+extern "C" bool __declspec(dllexport) AdvancedfxEnumerateEffectRuntimes(void** ppRuntimes, uint32_t* pCount) {
 
-				if (back_buffer_data._back_buffer_resolved != 0)
-				{
-					runtime->render_effects(command_list, back_buffer_data._back_buffer_revoled_targets[0], back_buffer_data._back_buffer_revoled_targets[1]);
-				}
-				else
-				{
-					if (old_back_buffer_resource_usage != resource_usage::render_target) command_list->barrier(back_buffer_resource, old_back_buffer_resource_usage, resource_usage::render_target);
-					runtime->render_effects(command_list, back_buffer_data._back_buffer_targets[0], back_buffer_data._back_buffer_targets[1]);
-					command_list->barrier(back_buffer_resource, resource_usage::render_target, old_back_buffer_resource_usage);
-				}
+	hlae_call_s call(g_Runtimes);
+	const auto runtimes = call.runtimes;
+	auto device = call.main_device;
+	if (device == 0 || pCount == 0)
+		return false;
 
-				// Stretch main render target back into MSAA back buffer if MSAA is active or copy when format conversion is required
-				if (back_buffer_data._back_buffer_resolved != 0)
-				{
-					const resource resources[2] = { back_buffer_resource, back_buffer_data._back_buffer_resolved };
-					const resource_usage state_old[2] = { resource_usage::copy_source | resource_usage::resolve_source, resource_usage::render_target };
-					const resource_usage state_final[2] = { resource_usage::present, resource_usage::resolve_dest };
+	uint32_t available = 0;
+	for (const auto& entry : runtimes->runtimes) {
+		if (entry.runtime->get_device() == device)
+			++available;
+	}
+	if (ppRuntimes == 0) {
+		*pCount = available;
+		return true;
+	}
+
+	uint32_t count = 0;
+	if (count < *pCount)
+		ppRuntimes[count++] = runtimes->main_runtime;
+	for (const auto& entry : runtimes->runtimes) {
+		if (count >= *pCount)
+			break;
+		if (entry.runtime != runtimes->main_runtime && entry.runtime->get_device() == device)
+			ppRuntimes[count++] = entry.runtime;
+	}
+	*pCount = count;
+	return true;
+}
 
-					if (device->get_api() == device_api::d3d10 ||
-						device->get_api() == device_api::d3d11 ||
-						device->get_api() == device_api::d3d12)
-					{
-						const resource_usage state_new[2] = { resource_usage::render_target, resource_usage::shader_resource };
+// Makes AdvancedfxRenderEffects(Batch) render pRenderTargetView with the effects of pRuntime
+// (as returned by AdvancedfxEnumerateEffectRuntimes) instead of the main runtime's.
+// A null pRuntime binds the render target back to the main runtime. Fails if a render target with a
+// render scale would share its runtime with another one.
+extern "C" bool __declspec(dllexport) AdvancedfxBindEffectRuntime(void* pRenderTargetView, void* pRuntime) {
 
-						command_list->barrier(2, resources, state_old, state_new);
+	hlae_call_s call(g_Runtimes);
+	const auto runtimes = call.runtimes;
+	auto device = call.main_device;
+	if (device == 0 || pRenderTargetView == 0)
+		return false;
 
-						command_list->bind_pipeline(pipeline_stage::all_graphics, _copy_pipeline);
+	auto device_data = device->get_private_data<device_data_s>();
+	return device_data->bind_stream_runtime(device, resource{ (uint64_t)pRenderTargetView }, static_cast<effect_runtime*>(pRuntime), *runtimes);
+}
 
-						command_list->push_descriptors(shader_stage::pixel, _copy_pipeline_layout, 0, descriptor_table_update{ {}, 0, 0, 1, descriptor_type::sampler, &_copy_sampler_state });
-						command_list->push_descriptors(shader_stage::pixel, _copy_pipeline_layout, 1, descriptor_table_update{ {}, 0, 0, 1, descriptor_type::shader_resource_view, &back_buffer_data._back_buffer_resolved_srv });
+// Near and far plane of HLAE's projection (near > far for reversed depth). While set, the depth
+// is also provided linearized as DEPTH_LINEAR and as min / max pyramid DEPTH_MIPS, and uniforms
+// with source "depth_near_plane" / "depth_far_plane" receive the planes. Pass 0, 0 to turn it off.
+extern "C" bool __declspec(dllexport) AdvancedfxSetDepthRange(float nearPlane, float farPlane) {
 
-						const viewport viewport = { 0.0f, 0.0f, static_cast<float>(back_buffer_data._width), static_cast<float>(back_buffer_data._height), 0.0f, 1.0f };
-						command_list->bind_viewports(0, 1, &viewport);
-						const rect scissor_rect = { 0, 0, static_cast<int32_t>(back_buffer_data._width), static_cast<int32_t>(back_buffer_data._height) };
-						command_list->bind_scissor_rects(0, 1, &scissor_rect);
+	hlae_call_s call(g_Runtimes);
+	auto device = call.main_device;
+	if (device == 0)
+		return false;
 
-						const bool srgb_write_enable = (back_buffer_data._back_buffer_format == format::r8g8b8a8_unorm_srgb || back_buffer_data._back_buffer_format == format::b8g8r8a8_unorm_srgb);
-						command_list->bind_render_targets_and_depth_stencil(1, &back_buffer_data._back_buffer_targets[srgb_write_enable?1:0]);
+	auto device_data = device->get_private_data<device_data_s>();
+	device_data->_depth_near_plane = nearPlane;
+	device_data->_depth_far_plane = farPlane;
+	return nearPlane == farPlane || (device_data->get_linear_depth_pipeline(device) != 0 && device_data->get_depth_min_max_pipeline(device) != 0);
+}
 
-						command_list->draw(3, 1, 0, 0);
+struct AdvancedfxUniforms {
+	float Fov;            // Horizontal, in degrees.
+	float NearPlane;
+	float FarPlane;
+	float Origin[3];
+	float Angles[3];      // Pitch, yaw, roll in degrees.
+	float View[16];       // Row by row.
+	float Projection[16]; // Row by row.
+	float DemoTime;       // In seconds.
+};
 
-						command_list->barrier(2, resources, state_new, state_final);
-					}
-					else
-					{
-						const resource_usage state_new[2] = { resource_usage::copy_dest, resource_usage::copy_source };
+// Sets HLAE's camera for the following AdvancedfxRenderEffects(Batch) calls, once per frame. Uniforms
+// annotated with source "camera_fov", "camera_near_plane", "camera_far_plane", "camera_origin",
+// "camera_angles", "camera_view", "camera_projection" or "demo_time" receive the values.
+extern "C" bool __declspec(dllexport) AdvancedfxSetUniforms(const AdvancedfxUniforms* pUniforms) {
 
-						command_list->barrier(2, resources, state_old, state_new);
-						command_list->copy_texture_region(back_buffer_data._back_buffer_resolved, 0, nullptr, back_buffer_resource, 0, nullptr);
-						command_list->barrier(2, resources, state_new, state_final);
-					}
-				}
+	hlae_call_s call(g_Runtimes);
+	auto device = call.main_device;
+	if (device == 0 || pUniforms == 0)
+		return false;
 
-				return true;
-			}
-		}
+	auto device_data = device->get_private_data<device_data_s>();
+	auto& camera = device_data->_camera;
+	camera.fov = pUniforms->Fov;
+	camera.near_plane = pUniforms->NearPlane;
+	camera.far_plane = pUniforms->FarPlane;
+	std::copy(std::begin(pUniforms->Origin), std::end(pUniforms->Origin), camera.origin);
+	std::copy(std::begin(pUniforms->Angles), std::end(pUniforms->Angles), camera.angles);
+	std::copy(std::begin(pUniforms->View), std::end(pUniforms->View), camera.view);
+	std::copy(std::begin(pUniforms->Projection), std::end(pUniforms->Projection), camera.projection);
+	camera.demo_time = pUniforms->DemoTime;
+	++device_data->_camera_serial;
+	return true;
+}
 
+// Called with the mapped rows of a processed frame, frame counts the copies made for the
+// render target since the readback was set. pData is only valid during the call.
+typedef void (*AdvancedfxReadbackCallback)(void* pUserData, uint64_t frame, const void* pData, uint32_t rowPitch, uint32_t width, uint32_t height, uint32_t format);
+
+// After each AdvancedfxRenderEffects(Batch) call on pRenderTargetView the processed image is
+// copied into one of ringSize staging textures, frame K is handed to callback during the call
+// that makes copy K + ringSize. Setting a null callback delivers all outstanding frames and
+// stops the readback.
+extern "C" bool __declspec(dllexport) AdvancedfxSetReadback(void* pRenderTargetView, AdvancedfxReadbackCallback callback, void* pUserData, uint32_t ringSize) {
+	hlae_call_s call(g_Runtimes);
+	auto device = call.main_device;
+	if (device == 0 || pRenderTargetView == 0)
 		return false;
-	}
-};
 
-effect_runtime* g_MainRuntime = 0;
+	auto device_data = device->get_private_data<device_data_s>();
+	if (device_data->_trace.is_active())
+		device_data->_trace.write_readback(device, resource{ (uint64_t)pRenderTargetView }, callback != nullptr ? ringSize : 0);
+	return device_data->set_readback(device, resource{ (uint64_t)pRenderTargetView }, callback, pUserData, ringSize);
+}
 
-void update_dependent_effect_runtime(effect_runtime* runtime, resource depth_buffer_resource, resource_view rsv) {
-	auto data = runtime->get_private_data<runtime_data_s>();
-	data->update_effect_runtime(runtime, depth_buffer_resource, rsv);
+// Writes a trace of the AdvancedfxRenderEffects(Batch) and AdvancedfxSetReadback calls and of
+// the destruction of the resources used in them to path, until AdvancedfxStopTrace. Traces are
+// replayed on a stand-in device with tests/trace_replay.
+extern "C" bool __declspec(dllexport) AdvancedfxStartTrace(const char* path) {
+	hlae_call_s call(g_Runtimes);
+	auto device = call.main_device;
+	if (device == 0 || path == 0)
+		return false;
+
+	auto device_data = device->get_private_data<device_data_s>();
+	return device_data->_trace.start(path);
 }
 
-static void update_effect_runtime(effect_runtime* runtime) {
-	auto data = runtime->get_private_data<runtime_data_s>();
-	data->update_effect_runtime(runtime);
+extern "C" bool __declspec(dllexport) AdvancedfxStopTrace() {
+	hlae_call_s call(g_Runtimes);
+	auto device = call.main_device;
+	if (device == 0)
+		return false;
+
+	auto device_data = device->get_private_data<device_data_s>();
+	device_data->_trace.stop();
+	return true;
 }
 
-extern "C" bool __declspec(dllexport) AdvancedfxRenderEffects(void* pRenderTargetView, void * pDepthTextureResource) {
+struct AdvancedfxTexturePoolStats {
+	uint64_t Hits;
+	uint64_t Misses;
+	uint64_t Evictions;
+	uint64_t InUseBytes;
+	uint64_t PooledBytes;
+	uint64_t BudgetBytes;
+};
 
-	if (g_MainRuntime == 0)
+extern "C" bool __declspec(dllexport) AdvancedfxGetTexturePoolStats(AdvancedfxTexturePoolStats* pStats) {
+	hlae_call_s call(g_Runtimes);
+	auto device = call.main_device;
+	if (device == 0 || pStats == 0)
 		return false;
 
-	if (pRenderTargetView == 0) {
-		// HLAE wants us to render no effects.
-		g_MainRuntime->set_effects_state(false);
-		return true;
-	}
+	const auto& texture_pool = device->get_private_data<device_data_s>()->_texture_pool;
+	pStats->Hits = texture_pool._hits;
+	pStats->Misses = texture_pool._misses;
+	pStats->Evictions = texture_pool._evictions;
+	pStats->InUseBytes = texture_pool._in_use_size;
+	pStats->PooledBytes = texture_pool._pooled_size;
+	pStats->BudgetBytes = texture_pool._budget;
+	return true;
+}
 
-	g_MainRuntime->set_effects_state(true);
-	auto device = g_MainRuntime->get_device();
-	if (device == 0)
+struct AdvancedfxStageStats {
+	uint64_t CpuMinNs;
+	uint64_t CpuAvgNs;
+	uint64_t CpuP99Ns;
+	uint64_t GpuMinNs;
+	uint64_t GpuAvgNs;
+	uint64_t GpuP99Ns;
+};
+
+struct AdvancedfxStats {
+	uint32_t Frames; // Number of AdvancedfxRenderEffects calls the stats are based on.
+	uint32_t GpuFrames; // Number of those that had GPU timestamps available.
+	AdvancedfxStageStats Resolve;
+	AdvancedfxStageStats Depth;
+	AdvancedfxStageStats Effects;
+	AdvancedfxStageStats WriteBack;
+	uint64_t TextureInUseBytes;
+	uint64_t TexturePooledBytes;
+};
+
+// Fails unless stats are collected, which ADVANCEDFX/CollectStats=1 turns on.
+extern "C" bool __declspec(dllexport) AdvancedfxGetStats(AdvancedfxStats* pStats) {
+	hlae_call_s call(g_Runtimes);
+	auto device = call.main_device;
+	if (device == 0 || pStats == 0)
 		return false;
 
-	auto device_data = device->get_private_data<device_data_s>();
-	auto runtime_data = g_MainRuntime->get_private_data<runtime_data_s>();
+	const auto device_data = device->get_private_data<device_data_s>();
+	if (!device_data->_render_stats._enabled)
+		return false;
 
-	resource back_buffer_resource{ (uint64_t)pRenderTargetView };
-	resource depth_buffer_resouce{ (uint64_t)pDepthTextureResource };
+	std::vector<render_stats_s::frame_s> frames;
+	device_data->_render_stats.read_history(frames);
 
-	runtime_data->block_effects = false;
-	auto result = device_data->render_effects(device, g_MainRuntime, back_buffer_resource, depth_buffer_resouce);
-	runtime_data->block_effects = true;
-	return result;
+	AdvancedfxStageStats* stages[render_stats_s::stage_count] = { &pStats->Resolve, &pStats->Depth, &pStats->Effects, &pStats->WriteBack };
+	std::vector<uint64_t> cpu_values, gpu_values;
+
+	pStats->Frames = static_cast<uint32_t>(frames.size());
+	pStats->GpuFrames = 0;
+	for (const auto& frame : frames) {
+		if (frame.has_gpu)
+			++pStats->GpuFrames;
+	}
+
+	for (uint32_t i = 0; i < render_stats_s::stage_count; ++i) {
+		cpu_values.clear();
+		gpu_values.clear();
+		for (const auto& frame : frames) {
+			cpu_values.push_back(frame.cpu_ns[i]);
+			if (frame.has_gpu)
+				gpu_values.push_back(frame.gpu_ns[i]);
+		}
+
+		const auto cpu = render_stats_s::summarize(cpu_values);
+		const auto gpu = render_stats_s::summarize(gpu_values);
+		*stages[i] = { cpu.min_ns, cpu.avg_ns, cpu.p99_ns, gpu.min_ns, gpu.avg_ns, gpu.p99_ns };
+	}
+
+	pStats->TextureInUseBytes = device_data->_texture_pool._in_use_size;
+	pStats->TexturePooledBytes = device_data->_texture_pool._pooled_size;
+	return true;
 }
 
 static void on_init_device(device* device) {
 	device->create_private_data<device_data_s>();
 
 	auto device_data = device->get_private_data<device_data_s>();
-	device_data->on_init_device(device);
+
+	unsigned int texture_pool_budget_mb = 0;
+	if (reshade::get_config_value(nullptr, "ADVANCEDFX", "TexturePoolBudgetMB", texture_pool_budget_mb))
+		device_data->_texture_pool.set_budget(device, static_cast<uint64_t>(texture_pool_budget_mb) << 20);
+	reshade::get_config_value(nullptr, "ADVANCEDFX", "DirectDepthBinding", device_data->_direct_depth_binding);
+	reshade::get_config_value(nullptr, "ADVANCEDFX", "CollectStats", device_data->_render_stats._enabled);
+	reshade::get_config_value(nullptr, "ADVANCEDFX", "HlaeOnly", device_data->_hlae_only);
+	// 0 = sample 0, 1 = min, 2 = max of the samples of a multisampled depth buffer.
+	reshade::get_config_value(nullptr, "ADVANCEDFX", "MsaaDepthResolve", device_data->_depth_resolve_mode);
+	// Previous frames per stream bound as COLOR_PREV / DEPTH_PREV, COLOR_PREV2 / DEPTH_PREV2 and so on.
+	if (reshade::get_config_value(nullptr, "ADVANCEDFX", "HistoryFrames", device_data->_history_frames))
+		device_data->_history_frames = std::min(device_data->_history_frames, runtime_data_s::max_history_frames);
 }
 
 static void on_destroy_device(device* device) {
@@ -498,40 +485,38 @@ static void on_destroy_device(device* device) {
 static void on_init_effect_runtime(effect_runtime *runtime)
 {
 	runtime->create_private_data<runtime_data_s>();
+	auto runtime_data = runtime->get_private_data<runtime_data_s>();
 
 	if (auto device = runtime->get_device()) {
 		auto device_data = device->get_private_data<device_data_s>();
-		device_data->_effect_runtimes.emplace(runtime);
+
+		// Latch the effects off once instead of toggling them around every present.
+		runtime_data->hlae_only = device_data->_hlae_only;
+		if (runtime_data->hlae_only)
+			runtime_data->set_effects_state(runtime, false);
+
+		g_Runtimes.add(runtime);
 	}
 }
 
 static void on_destroy_effect_runtime(effect_runtime *runtime)
 {
-	if (auto device = runtime->get_device()) {
-		auto device_data = device->get_private_data<device_data_s>();
-		device_data->_effect_runtimes.erase(runtime);
-	}
-
-	auto runtime_data = runtime->get_private_data<runtime_data_s>();
-	runtime_data->_current_depth_buffer_resource = { 0 };
-	runtime_data->_current_depth_texture_view = { 0 };
+	// Waits for HLAE's calls that may still use the runtime.
+	g_Runtimes.remove(runtime);
 
-	if (runtime == g_MainRuntime) {
-		g_MainRuntime = nullptr;
-	}
 	runtime->destroy_private_data<runtime_data_s>();
 }
 
 static void on_destroy_resource(device* device, resource resource) {
-	auto device_data = device->get_private_data<device_data_s>();
-	device_data->free_depth_resources(device, resource);
-	device_data->free_buffer_resources(device, resource);
+	// The runtimes whose bindings of the resource it drops can't be destroyed meanwhile.
+	epoch_guard_s guard(g_Runtimes._epochs);
+	device->get_private_data<device_data_s>()->on_destroy_resource(device, resource, g_Runtimes.get());
 }
 
 static void on_begin_render_effects(effect_runtime* runtime, command_list* /*cmd_list*/, resource_view, resource_view)
 {
 	auto data = runtime->get_private_data<runtime_data_s>();
-	if (data->block_effects) {
+	if (data->block_effects && !data->hlae_only) {
 		data->effects_were_enabled = runtime->get_effects_state();
 		if (data->effects_were_enabled) {
 			runtime->set_effects_state(false);
@@ -543,17 +528,28 @@ static void on_finish_render_effects(effect_runtime* runtime, command_list* /*cm
 {
 	auto data = runtime->get_private_data<runtime_data_s>();
 
-	if (data->block_effects && data->effects_were_enabled) {
+	if (data->block_effects && !data->hlae_only && data->effects_were_enabled) {
 			runtime->set_effects_state(true);
 	}
 }
 
 static bool on_reshade_set_effects_state(effect_runtime* runtime, bool enabled) {	
-	return false; // Effects should be toggled with mirv_streams and not with effects key.
+	// Effects should be toggled with mirv_streams and not with effects key, in HLAE only mode the key is
+	// blocked so ReShade's present pass stays off.
+	auto data = runtime->get_private_data<runtime_data_s>();
+	return data != nullptr && data->hlae_only && !data->switching_effects;
 }
 
 static void on_reshade_present(effect_runtime* runtime) {
-	if (nullptr == g_MainRuntime) g_MainRuntime = runtime;
+	if (!g_Runtimes.has_main_runtime())
+		g_Runtimes.set_main_runtime(runtime);
+
+	// The frame ends with the main runtime's present. The next HLAE call clears the cached effect
+	// results, which are only valid within a frame, and flushes the trace.
+	if (g_Runtimes.is_main_runtime(runtime)) {
+		if (auto device = runtime->get_device())
+			++device->get_private_data<device_data_s>()->_frame_serial;
+	}
 }
 
 
@@ -587,6 +583,7 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
 	switch (fdwReason)
 	{
 	case DLL_PROCESS_ATTACH:
+		g_hModule = hModule;
 		g_hReShadeModule = get_reshade_module_handle();
 
 		if (!reshade::register_addon(hModule))
@@ -603,11 +600,12 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
 		reshade::register_event<reshade::addon_event::reshade_present>(on_reshade_present);
 
 		// Need to set texture binding again after reloading
-		reshade::register_event<reshade::addon_event::reshade_reloaded_effects>(update_effect_runtime);
+		reshade::register_event<reshade::addon_event::reshade_reloaded_effects>(on_reshade_reloaded_effects);
 		break;
 	case DLL_PROCESS_DETACH:
 		reshade::unregister_addon(hModule);
 		g_hReShadeModule = nullptr;
+		g_hModule = nullptr;
 		break;
 	}
 
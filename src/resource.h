@@ -1,12 +1,16 @@
 //{{NO_DEPENDENCIES}}
 // Microsoft Visual C++ generated include file.
 // Used by Resource.rc
+//
+#define IDR_LINEARIZE_DEPTH_PS          201
+#define IDR_DEPTH_MIN_MAX_PS            202
+#define IDR_DEPTH_RESOLVE_PS            203
 
 // Nchste Standardwerte fr neue Objekte
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
-#define _APS_NEXT_RESOURCE_VALUE        101
+#define _APS_NEXT_RESOURCE_VALUE        204
 #define _APS_NEXT_COMMAND_VALUE         40001
 #define _APS_NEXT_CONTROL_VALUE         1001
 #define _APS_NEXT_SYMED_VALUE           101
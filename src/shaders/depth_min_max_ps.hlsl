@@ -0,0 +1,29 @@
+// Reduces one level of DEPTH_MIPS into the next, x holds the min and y the max linear depth.
+
+Texture2D<float2> source_level : register(t0);
+
+float2 main(float4 vpos : SV_POSITION, float2 texcoord : TEXCOORD0) : SV_TARGET
+{
+	uint width, height;
+	source_level.GetDimensions(width, height);
+
+	const int2 last = int2(width, height) - 1;
+	const int2 origin = int2(vpos.xy) * 2;
+
+	// Odd sized levels fold the extra row / column into the last destination texel.
+	const int2 extent = int2(
+		(origin.x + 2 == last.x) ? 3 : 2,
+		(origin.y + 2 == last.y) ? 3 : 2);
+
+	float2 result = float2(1e38, 0.0);
+	for (int y = 0; y < extent.y; ++y)
+	{
+		for (int x = 0; x < extent.x; ++x)
+		{
+			const float2 value = source_level.Load(int3(min(origin + int2(x, y), last), 0));
+			result.x = min(result.x, value.x);
+			result.y = max(result.y, value.y);
+		}
+	}
+	return result;
+}
@@ -0,0 +1,26 @@
+// Resolves HLAE's multisampled depth buffer, so HLAE can hand it over without resolving it first.
+
+cbuffer resolve : register(b0)
+{
+	uint mode; // 0 = sample 0, 1 = min, 2 = max, see device_data_s::depth_resolve_e
+};
+
+Texture2DMS<float> depth_texture : register(t0);
+
+float main(float4 vpos : SV_POSITION, float2 texcoord : TEXCOORD0) : SV_TARGET
+{
+	uint width, height, samples;
+	depth_texture.GetDimensions(width, height, samples);
+
+	const int2 position = int2(vpos.xy);
+	float result = depth_texture.Load(position, 0);
+	if (mode == 0)
+		return result;
+
+	for (uint i = 1; i < samples; ++i)
+	{
+		const float depth = depth_texture.Load(position, i);
+		result = (mode == 1) ? min(result, depth) : max(result, depth);
+	}
+	return result;
+}
@@ -0,0 +1,17 @@
+// Writes the linear view depth of HLAE's depth buffer into DEPTH_LINEAR and level 0 of DEPTH_MIPS.
+
+cbuffer depth_range : register(b0)
+{
+	float near_plane; // Pass near > far for reversed depth.
+	float far_plane;
+};
+
+Texture2D<float> depth_texture : register(t0);
+
+void main(float4 vpos : SV_POSITION, float2 texcoord : TEXCOORD0, out float linear_depth : SV_TARGET0, out float2 min_max : SV_TARGET1)
+{
+	const float depth = depth_texture.Load(int3(vpos.xy, 0));
+
+	linear_depth = near_plane * far_plane / (far_plane - depth * (far_plane - near_plane));
+	min_max = linear_depth.xx;
+}
@@ -0,0 +1,198 @@
+#include "mock_reshade_api.hpp"
+#include "test_harness.hpp"
+
+#include <deque>
+#include <thread>
+
+using namespace advancedfx_test;
+
+// Runs HLAE's calls against ReShade's events on other threads, the way the game and ReShade do it.
+// Meant to be built with -DADVANCEDFX_TSAN=ON, without it they only catch what corrupts the results.
+
+namespace {
+
+	const resource_usage target_usage = resource_usage::render_target | resource_usage::shader_resource | resource_usage::copy_source | resource_usage::copy_dest;
+	const resource_usage depth_usage = resource_usage::depth_stencil | resource_usage::shader_resource | resource_usage::copy_source;
+
+	const uint32_t hlae_calls = 2000;
+
+	void check_no_errors(mock_setup_s& setup) {
+		const auto errors = setup.device.take_errors();
+		for (const auto& error : errors)
+			std::fprintf(stderr, "mock: %s\n", error.c_str());
+		CHECK(errors.empty());
+	}
+
+	// Like AdvancedfxBindEffectRuntime followed by AdvancedfxRenderEffects.
+	bool render_effects(mock_setup_s& setup, resource back_buffer_resource, resource depth_buffer_resource) {
+		hlae_call_s call(setup.runtimes);
+		if (call.main_device == nullptr)
+			return false;
+
+		// Binds the target to the newest runtime, which ReShade may be destroying meanwhile.
+		effect_runtime* stream_runtime = call.runtimes->runtimes.back().runtime;
+		CHECK(setup.device_data->bind_stream_runtime(&setup.device, back_buffer_resource, stream_runtime, *call.runtimes));
+
+		const auto runtime = setup.device_data->get_stream_runtime(back_buffer_resource, *call.runtimes);
+		const auto runtime_data = runtime->get_private_data<runtime_data_s>();
+		device_data_s::render_request_s request = { back_buffer_resource, depth_buffer_resource, 0, false, 0, false, nullptr, resource_usage::undefined, false, nullptr, pipeline{ 0 }, false };
+		runtime_data->begin_hlae_effects(runtime);
+		const bool result = setup.device_data->render_effects(&setup.device, runtime, &request, 1) && request.result;
+		runtime_data->end_hlae_effects(runtime);
+		return result;
+	}
+}
+
+TEST_CASE(epoch_domain_keeps_objects_alive_for_readers) {
+	struct value_s {
+		uint64_t value;
+	};
+
+	epoch_domain_s domain;
+	std::atomic<value_s*> published{ new value_s{ 1 } };
+	std::atomic<bool> stop{ false };
+	std::atomic<uint32_t> bad_reads{ 0 };
+
+	std::vector<std::thread> readers;
+	for (int i = 0; i < 3; ++i) {
+		readers.emplace_back([&]() {
+			while (!stop.load()) {
+				epoch_guard_s guard(domain);
+				const value_s* value = published.load(std::memory_order_acquire);
+				if (value->value == 0)
+					++bad_reads;
+			}
+			});
+	}
+
+	// The writer poisons and frees each value once synchronize returned.
+	for (uint64_t i = 2; i < 20000; ++i) {
+		value_s* old_value = published.exchange(new value_s{ i }, std::memory_order_acq_rel);
+		domain.synchronize();
+		old_value->value = 0;
+		delete old_value;
+	}
+
+	stop = true;
+	for (auto& reader : readers)
+		reader.join();
+	delete published.load();
+	CHECK(bad_reads == 0);
+}
+
+TEST_CASE(runtime_registry_keeps_snapshots_alive_for_readers) {
+	mock_device_s device(device_api::d3d11);
+	mock_command_queue_s queue(&device, command_queue_type::graphics);
+	mock_effect_runtime_s main_runtime(&device, &queue);
+
+	runtime_registry_s registry;
+	registry.add(&main_runtime);
+	registry.set_main_runtime(&main_runtime);
+
+	std::atomic<bool> stop{ false };
+	std::atomic<uint32_t> bad_reads{ 0 };
+	std::thread reader([&]() {
+		while (!stop.load()) {
+			epoch_guard_s guard(registry._epochs);
+			const auto snapshot = registry.get();
+			// Every runtime in a snapshot has to stay alive until the read section ends.
+			for (const auto& entry : snapshot->runtimes) {
+				if (entry.runtime->get_device() != &device)
+					++bad_reads;
+			}
+			if (snapshot->main_runtime != &main_runtime)
+				++bad_reads;
+		}
+		});
+
+	for (int i = 0; i < 2000; ++i) {
+		auto runtime = new mock_effect_runtime_s(&device, &queue);
+		registry.add(runtime);
+		registry.remove(runtime);
+		// A reader that still sees it counts a bad read.
+		runtime->_device = nullptr;
+		delete runtime;
+	}
+
+	stop = true;
+	reader.join();
+	CHECK(bad_reads == 0);
+}
+
+TEST_CASE(destroy_and_reload_race_hlae_calls) {
+	mock_setup_s setup(device_api::d3d11);
+	const resource depth = setup.device.create_texture(320, 180, format::r32_typeless, 1, depth_usage, resource_usage::depth_stencil);
+
+	std::atomic<bool> stop{ false };
+
+	// ReShade creating, reloading and destroying stream runtimes, like on_init / on_destroy_effect_runtime.
+	std::atomic<uint32_t> runtimes_destroyed{ 0 };
+	std::thread reshade([&]() {
+		while (!stop.load()) {
+			auto runtime = new mock_effect_runtime_s(&setup.device, &setup.queue);
+			auto runtime_data = runtime->create_private_data<runtime_data_s>();
+			setup.runtimes.add(runtime);
+			for (int i = 0; i < 4; ++i) {
+				runtime_data->_reload_pending = true;
+				std::this_thread::yield();
+			}
+			// Waits for HLAE's calls that may still use the runtime.
+			setup.runtimes.remove(runtime);
+			runtime->destroy_private_data<runtime_data_s>();
+			delete runtime;
+			++runtimes_destroyed;
+		}
+		});
+
+	// The game destroying the targets HLAE rendered, the destroy_resource event runs on its thread.
+	std::mutex destroy_mutex;
+	std::deque<resource> to_destroy;
+	uint32_t targets_destroyed = 0;
+	std::thread game([&]() {
+		for (;;) {
+			resource target = { 0 };
+			{
+				std::lock_guard<std::mutex> lock(destroy_mutex);
+				if (!to_destroy.empty()) {
+					target = to_destroy.front();
+					to_destroy.pop_front();
+				}
+			}
+			if (target == 0) {
+				if (stop.load())
+					break;
+				std::this_thread::yield();
+				continue;
+			}
+			setup.destroy_resource(target);
+			++targets_destroyed;
+		}
+		});
+
+	uint32_t failed_calls = 0;
+	resource target = { 0 };
+	for (uint32_t i = 0; i < hlae_calls; ++i) {
+		if (i % 4 == 0) {
+			if (target != 0) {
+				std::lock_guard<std::mutex> lock(destroy_mutex);
+				to_destroy.push_back(target);
+			}
+			target = setup.device.create_texture(320, 180, format::r8g8b8a8_unorm, 1, target_usage, target_usage);
+		}
+		if (!render_effects(setup, target, depth))
+			++failed_calls;
+	}
+
+	stop = true;
+	reshade.join();
+	game.join();
+
+	// Frees what the last destroy events left.
+	{ hlae_call_s call(setup.runtimes); }
+	CHECK(failed_calls == 0);
+	CHECK(targets_destroyed == hlae_calls / 4 - 1);
+	CHECK(runtimes_destroyed > 0);
+	check_no_errors(setup);
+}
+
+TEST_MAIN()
@@ -0,0 +1,580 @@
+#include "mock_reshade_api.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+// The shaders aren't run, any non-empty blob does.
+static const uint8_t dummy_shader[4] = { 0x44, 0x58, 0x42, 0x43 };
+
+data_resource load_data_resource(unsigned short)
+{
+	return { sizeof(dummy_shader), dummy_shader };
+}
+
+data_resource load_addon_data_resource(unsigned short)
+{
+	return { sizeof(dummy_shader), dummy_shader };
+}
+
+namespace advancedfx_test {
+
+static std::string format_message(const char* format, ...) {
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	std::vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	return buffer;
+}
+
+counters_s operator-(const counters_s& a, const counters_s& b) {
+	counters_s result;
+	result.commands = a.commands - b.commands;
+	result.barrier_calls = a.barrier_calls - b.barrier_calls;
+	result.transitions = a.transitions - b.transitions;
+	result.copies = a.copies - b.copies;
+	result.resolves = a.resolves - b.resolves;
+	result.draws = a.draws - b.draws;
+	result.effect_passes = a.effect_passes - b.effect_passes;
+	result.resources_created = a.resources_created - b.resources_created;
+	result.resources_destroyed = a.resources_destroyed - b.resources_destroyed;
+	result.views_created = a.views_created - b.views_created;
+	result.views_destroyed = a.views_destroyed - b.views_destroyed;
+	result.pipelines_created = a.pipelines_created - b.pipelines_created;
+	result.maps = a.maps - b.maps;
+	result.signals = a.signals - b.signals;
+	result.waits = a.waits - b.waits;
+	result.effects_state_changes = a.effects_state_changes - b.effects_state_changes;
+	return result;
+}
+
+uint64_t private_data_s::get(const uint8_t key[16]) const {
+	auto it = _values.find(std::string(reinterpret_cast<const char*>(key), 16));
+	return it != _values.end() ? it->second : 0;
+}
+
+void private_data_s::set(const uint8_t key[16], uint64_t value) {
+	_values[std::string(reinterpret_cast<const char*>(key), 16)] = value;
+}
+
+resource mock_device_s::create_texture(uint32_t width, uint32_t height, format format, uint16_t samples, resource_usage usage, resource_usage initial_state) {
+	resource texture = { 0 };
+	create_resource(resource_desc(width, height, 1, 1, format, samples, memory_heap::gpu_only, usage), nullptr, initial_state, &texture);
+	return texture;
+}
+
+resource_usage mock_device_s::get_state(resource resource) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _resources.find(resource.handle);
+	return it != _resources.end() ? it->second.state : resource_usage::undefined;
+}
+
+resource mock_device_s::get_view_resource(resource_view view) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _views.find(view.handle);
+	return it != _views.end() ? it->second.target : resource{ 0 };
+}
+
+format mock_device_s::get_view_format(resource_view view) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _views.find(view.handle);
+	return it != _views.end() ? it->second.desc.format : format::unknown;
+}
+
+size_t mock_device_s::get_resource_count() const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _resources.size();
+}
+
+size_t mock_device_s::get_view_count() const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _views.size();
+}
+
+size_t mock_device_s::get_view_count(resource target) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	size_t count = 0;
+	for (const auto& view : _views)
+		count += view.second.target == target ? 1 : 0;
+	return count;
+}
+
+counters_s mock_device_s::get_counters() const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _counters;
+}
+
+std::vector<command_s> mock_device_s::take_log() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<command_s> log;
+	log.swap(_log);
+	return log;
+}
+
+std::vector<std::string> mock_device_s::take_errors() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<std::string> errors;
+	errors.swap(_errors);
+	return errors;
+}
+
+void mock_device_s::record(const command_s& command) {
+	if (command.queue != nullptr)
+		++_counters.commands;
+	if (_recording)
+		_log.push_back(command);
+}
+
+void mock_device_s::error(const std::string& message) {
+	_errors.push_back(message);
+}
+
+// General allows any access, like the common state of D3D12.
+bool mock_device_s::allows(resource resource, resource_usage usage) {
+	auto it = _resources.find(resource.handle);
+	if (it == _resources.end()) {
+		error(format_message("resource %llx used after it was destroyed", static_cast<unsigned long long>(resource.handle)));
+		return false;
+	}
+	const resource_usage state = it->second.state;
+	if (state == resource_usage::general || (state & usage) == usage)
+		return true;
+	error(format_message("resource %llx used as %x while in state %x", static_cast<unsigned long long>(resource.handle), static_cast<uint32_t>(usage), static_cast<uint32_t>(state)));
+	return false;
+}
+
+void mock_device_s::get_private_data(const uint8_t key[16], uint64_t* value) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	*value = _private_data.get(key);
+}
+
+void mock_device_s::set_private_data(const uint8_t key[16], const uint64_t value) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_private_data.set(key, value);
+}
+
+bool mock_device_s::create_sampler(const sampler_desc&, sampler* out_sampler) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	*out_sampler = { next_handle() };
+	return true;
+}
+
+bool mock_device_s::create_resource(const resource_desc& desc, const subresource_data*, resource_usage initial_state, resource* out_resource, void**) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	*out_resource = { next_handle() };
+	_resources[out_resource->handle] = { desc, initial_state, {} };
+	++_counters.resources_created;
+	record({ op_e::create_resource, nullptr, *out_resource, { 0 }, initial_state, initial_state, { 0 }, 0 });
+	return true;
+}
+
+void mock_device_s::destroy_resource(resource resource) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_resources.erase(resource.handle) == 0)
+		error(format_message("resource %llx destroyed twice", static_cast<unsigned long long>(resource.handle)));
+	for (const auto& view : _views) {
+		if (view.second.target == resource)
+			error(format_message("resource %llx destroyed before its view %llx", static_cast<unsigned long long>(resource.handle), static_cast<unsigned long long>(view.first)));
+	}
+	++_counters.resources_destroyed;
+	record({ op_e::destroy_resource, nullptr, resource, { 0 }, resource_usage::undefined, resource_usage::undefined, { 0 }, 0 });
+}
+
+resource_desc mock_device_s::get_resource_desc(resource resource) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _resources.find(resource.handle);
+	return it != _resources.end() ? it->second.desc : resource_desc();
+}
+
+bool mock_device_s::create_resource_view(resource resource, resource_usage usage_type, const resource_view_desc& desc, resource_view* out_view) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _resources.find(resource.handle);
+	if (it == _resources.end()) {
+		error("view created on a resource that doesn't exist");
+		return false;
+	}
+	// Like DXGI, views can only reinterpret formats of the same typeless family.
+	const resource_desc& resource_desc = it->second.desc;
+	if (_api != device_api::vulkan && _api != device_api::opengl
+		&& format_to_typeless(desc.format) != format_to_typeless(resource_desc.texture.format)
+		&& desc.format != resource_desc.texture.format) {
+		error(format_message("view format %u is not compatible with resource format %u", static_cast<uint32_t>(desc.format), static_cast<uint32_t>(resource_desc.texture.format)));
+		return false;
+	}
+	if ((resource_desc.usage & usage_type) != usage_type) {
+		error(format_message("view usage %x not in resource usage %x", static_cast<uint32_t>(usage_type), static_cast<uint32_t>(resource_desc.usage)));
+		return false;
+	}
+
+	*out_view = { next_handle() };
+	_views[out_view->handle] = { resource, usage_type, desc };
+	++_counters.views_created;
+	record({ op_e::create_view, nullptr, resource, { 0 }, usage_type, usage_type, *out_view, 0 });
+	return true;
+}
+
+void mock_device_s::destroy_resource_view(resource_view view) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_views.erase(view.handle) == 0)
+		error(format_message("view %llx destroyed twice", static_cast<unsigned long long>(view.handle)));
+	++_counters.views_destroyed;
+	record({ op_e::destroy_view, nullptr, { 0 }, { 0 }, resource_usage::undefined, resource_usage::undefined, view, 0 });
+}
+
+resource_view_desc mock_device_s::get_resource_view_desc(resource_view view) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _views.find(view.handle);
+	return it != _views.end() ? it->second.desc : resource_view_desc();
+}
+
+bool mock_device_s::map_texture_region(resource resource, uint32_t, const subresource_box*, map_access, subresource_data* out_data) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _resources.find(resource.handle);
+	if (it == _resources.end())
+		return false;
+	const resource_desc& desc = it->second.desc;
+	const uint32_t row_pitch = format_row_pitch(desc.texture.format, desc.texture.width);
+	it->second.memory.resize(static_cast<size_t>(row_pitch) * desc.texture.height);
+	*out_data = { it->second.memory.data(), row_pitch, row_pitch * desc.texture.height };
+	++_counters.maps;
+	record({ op_e::map, nullptr, resource, { 0 }, resource_usage::undefined, resource_usage::undefined, { 0 }, 0 });
+	return true;
+}
+
+bool mock_device_s::create_pipeline(pipeline_layout, uint32_t subobject_count, const pipeline_subobject* subobjects, pipeline* out_pipeline) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	pipeline_entry_s entry = { format::unknown, 1 };
+	for (uint32_t i = 0; i < subobject_count; ++i) {
+		if (subobjects[i].type == pipeline_subobject_type::render_target_formats && subobjects[i].count != 0)
+			entry.target_format = static_cast<const format*>(subobjects[i].data)[0];
+		if (subobjects[i].type == pipeline_subobject_type::sample_count)
+			entry.samples = *static_cast<const uint32_t*>(subobjects[i].data);
+	}
+	*out_pipeline = { next_handle() };
+	_pipelines[out_pipeline->handle] = entry;
+	++_counters.pipelines_created;
+	record({ op_e::create_pipeline, nullptr, { 0 }, { 0 }, resource_usage::undefined, resource_usage::undefined, { 0 }, out_pipeline->handle });
+	return true;
+}
+
+void mock_device_s::destroy_pipeline(pipeline pipeline) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_pipelines.erase(pipeline.handle);
+}
+
+bool mock_device_s::create_pipeline_layout(uint32_t, const pipeline_layout_param*, pipeline_layout* out_layout) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	*out_layout = { next_handle() };
+	return true;
+}
+
+bool mock_device_s::create_query_heap(query_type, uint32_t, query_heap* out_heap) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	*out_heap = { next_handle() };
+	return true;
+}
+
+bool mock_device_s::create_fence(uint64_t initial_value, fence_flags, fence* out_fence, void**) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	*out_fence = { next_handle() };
+	_fences[out_fence->handle] = initial_value;
+	return true;
+}
+
+void mock_device_s::destroy_fence(fence fence) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_fences.erase(fence.handle);
+}
+
+// Queues execute right away, so a fence is complete once it was signaled.
+uint64_t mock_device_s::get_completed_fence_value(fence fence) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _fences.find(fence.handle);
+	return it != _fences.end() ? it->second : 0;
+}
+
+bool mock_device_s::wait(fence fence, uint64_t value, uint64_t) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _fences.find(fence.handle);
+	if (it == _fences.end() || it->second < value) {
+		error("device waits for a fence value that is never signaled");
+		return false;
+	}
+	return true;
+}
+
+bool mock_device_s::signal(fence fence, uint64_t value) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_fences[fence.handle] = value;
+	return true;
+}
+
+void mock_command_list_s::barrier(uint32_t count, const resource* resources, const resource_usage* old_states, const resource_usage* new_states) {
+	std::lock_guard<std::mutex> lock(_device->_mutex);
+	++_device->_counters.barrier_calls;
+	for (uint32_t i = 0; i < count; ++i) {
+		++_device->_counters.transitions;
+		auto it = _device->_resources.find(resources[i].handle);
+		if (it == _device->_resources.end()) {
+			_device->error("barrier on a resource that doesn't exist");
+			continue;
+		}
+		if (it->second.state != old_states[i])
+			_device->error(format_message("barrier on %llx from %x, but it is in %x", static_cast<unsigned long long>(resources[i].handle),
+				static_cast<uint32_t>(old_states[i]), static_cast<uint32_t>(it->second.state)));
+		it->second.state = new_states[i];
+		_device->record({ op_e::barrier, _queue, resources[i], { 0 }, old_states[i], new_states[i], { 0 }, 0 });
+	}
+}
+
+void mock_command_list_s::bind_render_targets_and_depth_stencil(uint32_t count, const resource_view* rtvs, resource_view) {
+	_target = count != 0 ? rtvs[0] : resource_view{ 0 };
+}
+
+void mock_command_list_s::bind_pipeline(pipeline_stage, pipeline pipeline) {
+	_pipeline = pipeline;
+	_shader_resources.clear();
+}
+
+void mock_command_list_s::push_descriptors(shader_stage, pipeline_layout, uint32_t, const descriptor_table_update& update) {
+	if (update.type != descriptor_type::shader_resource_view)
+		return;
+	_shader_resources.assign(static_cast<const resource_view*>(update.descriptors), static_cast<const resource_view*>(update.descriptors) + update.count);
+}
+
+void mock_command_list_s::draw(uint32_t, uint32_t, uint32_t, uint32_t) {
+	std::lock_guard<std::mutex> lock(_device->_mutex);
+	++_device->_counters.draws;
+
+	auto view = _device->_views.find(_target.handle);
+	auto pipeline = _device->_pipelines.find(_pipeline.handle);
+	if (view == _device->_views.end() || pipeline == _device->_pipelines.end()) {
+		_device->error("draw without render target or pipeline");
+		return;
+	}
+	if (pipeline->second.target_format != view->second.desc.format)
+		_device->error(format_message("draw with a pipeline for format %u into a view of format %u",
+			static_cast<uint32_t>(pipeline->second.target_format), static_cast<uint32_t>(view->second.desc.format)));
+	if (pipeline->second.target_format != view->second.desc.format)
+		_device->error(format_message("draw with a pipeline for format %u into a view of format %u",
+			static_cast<uint32_t>(pipeline->second.target_format), static_cast<uint32_t>(view->second.desc.format)));
+	const auto target = _device->_resources.find(view->second.target.handle);
+	// D3D12 and Vulkan pipelines are built for one sample count.
+	if ((_device->_api == device_api::d3d12 || _device->_api == device_api::vulkan) && target != _device->_resources.end() && target->second.desc.texture.samples != pipeline->second.samples)
+		_device->error("draw with a pipeline for another sample count than the target's");
+	_device->allows(view->second.target, resource_usage::render_target);
+	for (const auto srv : _shader_resources) {
+		auto source = _device->_views.find(srv.handle);
+		if (source != _device->_views.end())
+			_device->allows(source->second.target, resource_usage::shader_resource);
+	}
+
+	_device->record({ op_e::draw, _queue, { 0 }, view->second.target, resource_usage::undefined, resource_usage::undefined, _target, 0 });
+}
+
+void mock_command_list_s::copy(op_e op, resource source, resource dest) {
+	std::lock_guard<std::mutex> lock(_device->_mutex);
+	if (op == op_e::copy)
+		++_device->_counters.copies;
+	else
+		++_device->_counters.resolves;
+	_device->allows(source, op == op_e::copy ? resource_usage::copy_source : resource_usage::resolve_source);
+	_device->allows(dest, op == op_e::copy ? resource_usage::copy_dest : resource_usage::resolve_dest);
+	_device->record({ op, _queue, source, dest, resource_usage::undefined, resource_usage::undefined, { 0 }, 0 });
+}
+
+void mock_command_list_s::copy_resource(resource source, resource dest) {
+	copy(op_e::copy, source, dest);
+}
+
+void mock_command_list_s::copy_texture_region(resource source, uint32_t, const subresource_box*, resource dest, uint32_t, const subresource_box*, filter_mode) {
+	copy(op_e::copy, source, dest);
+}
+
+void mock_command_list_s::resolve_texture_region(resource source, uint32_t, const subresource_box*, resource dest, uint32_t, int32_t, int32_t, int32_t, format) {
+	copy(op_e::resolve, source, dest);
+}
+
+void mock_command_queue_s::flush_immediate_command_list() const {
+	std::lock_guard<std::mutex> lock(_device->_mutex);
+	_device->record({ op_e::flush, this, { 0 }, { 0 }, resource_usage::undefined, resource_usage::undefined, { 0 }, 0 });
+}
+
+bool mock_command_queue_s::wait(fence fence, uint64_t value) {
+	std::lock_guard<std::mutex> lock(_device->_mutex);
+	++_device->_counters.waits;
+	auto it = _device->_fences.find(fence.handle);
+	if (it == _device->_fences.end() || it->second < value)
+		_device->error("queue waits for a fence value that wasn't signaled before");
+	_device->record({ op_e::wait, this, { 0 }, { 0 }, resource_usage::undefined, resource_usage::undefined, { 0 }, value });
+	return true;
+}
+
+bool mock_command_queue_s::signal(fence fence, uint64_t value) {
+	std::lock_guard<std::mutex> lock(_device->_mutex);
+	++_device->_counters.signals;
+	_device->_fences[fence.handle] = value;
+	_device->record({ op_e::signal, this, { 0 }, { 0 }, resource_usage::undefined, resource_usage::undefined, { 0 }, value });
+	return true;
+}
+
+void mock_effect_runtime_s::render_effects(command_list* cmd_list, resource_view rtv, resource_view) {
+	auto list = static_cast<mock_command_list_s*>(cmd_list);
+	std::lock_guard<std::mutex> lock(_device->_mutex);
+	++_device->_counters.effect_passes;
+
+	auto view = _device->_views.find(rtv.handle);
+	if (view == _device->_views.end()) {
+		_device->error("effects rendered into a view that doesn't exist");
+		return;
+	}
+	_device->allows(view->second.target, resource_usage::render_target);
+	auto target = _device->_resources.find(view->second.target.handle);
+	if (target != _device->_resources.end()) {
+		const auto& texture = target->second.desc.texture;
+		if (_width != 0 && (texture.width != _width || texture.height != _height))
+			++_resizes;
+		_width = texture.width;
+		_height = texture.height;
+	}
+	for (const auto& semantic : _checked_bindings) {
+		auto binding = _bindings.find(semantic);
+		if (binding == _bindings.end() || binding->second == 0)
+			continue;
+		auto source = _device->_views.find(binding->second.handle);
+		if (source == _device->_views.end())
+			_device->error(semantic + " is bound to a view that doesn't exist");
+		else
+			_device->allows(source->second.target, resource_usage::shader_resource);
+	}
+
+	_device->record({ op_e::render_effects, list->_queue, { 0 }, view->second.target, resource_usage::undefined, resource_usage::undefined, rtv, _effects_enabled ? 1u : 0u });
+}
+
+void mock_effect_runtime_s::enumerate_uniform_variables(const char*, void(*callback)(effect_runtime* runtime, effect_uniform_variable variable, void* user_data), void* user_data) {
+	for (size_t i = 0; i < _uniforms.size(); ++i)
+		callback(this, { i + 1 }, user_data);
+}
+
+void mock_effect_runtime_s::get_uniform_variable_name(effect_uniform_variable variable, char* name, size_t* name_size) const {
+	std::snprintf(name, *name_size, "%s", _uniforms.at(variable.handle - 1).name.c_str());
+}
+
+bool mock_effect_runtime_s::get_annotation_string_from_uniform_variable(effect_uniform_variable variable, const char* name, char* value, size_t* value_size) const {
+	const auto& uniform = _uniforms.at(variable.handle - 1);
+	if (std::strcmp(name, "source") != 0 || uniform.source.empty())
+		return false;
+	std::snprintf(value, *value_size, "%s", uniform.source.c_str());
+	return true;
+}
+
+void mock_effect_runtime_s::set_uniform_value_float(effect_uniform_variable variable, const float* values, size_t count, size_t) {
+	++_uniform_writes;
+	_uniforms.at(variable.handle - 1).values.assign(values, values + count);
+}
+
+void mock_effect_runtime_s::update_texture_bindings(const char* semantic, resource_view srv, resource_view) {
+	_bindings[semantic] = srv;
+}
+
+void mock_effect_runtime_s::enumerate_techniques(const char*, void(*callback)(effect_runtime* runtime, effect_technique technique, void* user_data), void* user_data) {
+	for (size_t i = 0; i < _techniques.size(); ++i)
+		callback(this, { i + 1 }, user_data);
+}
+
+void mock_effect_runtime_s::get_technique_name(effect_technique technique, char* name, size_t* name_size) const {
+	std::snprintf(name, *name_size, "%s", _techniques.at(technique.handle - 1).name.c_str());
+}
+
+bool mock_effect_runtime_s::get_technique_state(effect_technique technique) const {
+	return _techniques.at(technique.handle - 1).enabled;
+}
+
+void mock_effect_runtime_s::set_technique_state(effect_technique technique, bool enabled) {
+	++_technique_switches;
+	_techniques.at(technique.handle - 1).enabled = enabled;
+}
+
+void mock_effect_runtime_s::set_effects_state(bool enabled) {
+	std::lock_guard<std::mutex> lock(_device->_mutex);
+	++_device->_counters.effects_state_changes;
+	_device->record({ op_e::set_effects_state, nullptr, { 0 }, { 0 }, resource_usage::undefined, resource_usage::undefined, { 0 }, enabled ? 1u : 0u });
+	_effects_enabled = enabled;
+}
+
+mock_setup_s::mock_setup_s(device_api api) : device(api), queue(&device, command_queue_type::graphics), runtime(&device, &queue) {
+	device_data = device.create_private_data<device_data_s>();
+	runtime_data = runtime.create_private_data<runtime_data_s>();
+	runtimes.add(&runtime);
+	runtimes.set_main_runtime(&runtime);
+}
+
+mock_setup_s::~mock_setup_s() {
+	runtimes.remove(&runtime);
+	device_data->on_destroy_device(&device);
+	device.destroy_private_data<device_data_s>();
+	runtime.destroy_private_data<runtime_data_s>();
+}
+
+bool mock_setup_s::render_effects(resource back_buffer_resource, resource depth_buffer_resource, uint64_t content_key,
+	bool use_technique_mask, uint64_t technique_mask) {
+	hlae_call_s call(runtimes);
+	if (call.main_device == nullptr)
+		return false;
+
+	if (back_buffer_resource == 0) {
+		call.runtimes->main_runtime->get_private_data<runtime_data_s>()->skip_hlae_effects(call.runtimes->main_runtime);
+		return true;
+	}
+	auto stream_runtime = device_data->get_stream_runtime(back_buffer_resource, *call.runtimes);
+	auto stream_runtime_data = stream_runtime->get_private_data<runtime_data_s>();
+	const uint64_t trace_time = device_data->_trace.is_active() ? device_data->_trace.now() : 0;
+
+	device_data_s::render_request_s request = { back_buffer_resource, depth_buffer_resource, content_key, use_technique_mask, technique_mask, false, nullptr, resource_usage::undefined, false, nullptr, pipeline{ 0 }, false };
+	stream_runtime_data->begin_hlae_effects(stream_runtime);
+	const bool result = device_data->render_effects(&device, stream_runtime, &request, 1) && request.result;
+	stream_runtime_data->end_hlae_effects(stream_runtime);
+
+	if (device_data->_trace.is_active()) {
+		const auto entry = device_data_s::get_trace_entry(request);
+		device_data->_trace.write_render(&device, &entry, 1, trace_time, device_data->_trace.now() - trace_time);
+	}
+	return result;
+}
+
+bool mock_setup_s::bind_effect_runtime(resource back_buffer_resource, effect_runtime* stream_runtime) {
+	hlae_call_s call(runtimes);
+	if (call.main_device == nullptr)
+		return false;
+	return device_data->bind_stream_runtime(&device, back_buffer_resource, stream_runtime, *call.runtimes);
+}
+
+bool mock_setup_s::set_render_scale(resource back_buffer_resource, uint32_t scale) {
+	hlae_call_s call(runtimes);
+	if (call.main_device == nullptr)
+		return false;
+	return device_data->set_render_scale(&device, back_buffer_resource, scale, *call.runtimes);
+}
+
+bool mock_setup_s::set_render_rect(resource back_buffer_resource, rect crop) {
+	hlae_call_s call(runtimes);
+	if (call.main_device == nullptr)
+		return false;
+	return device_data->set_render_rect(&device, back_buffer_resource, crop, *call.runtimes);
+}
+
+void mock_setup_s::destroy_resource(resource resource) {
+	{
+		epoch_guard_s guard(runtimes._epochs);
+		device_data->on_destroy_resource(&device, resource, runtimes.get());
+	}
+	device.destroy_resource(resource);
+}
+
+void mock_setup_s::present() {
+	if (runtimes.is_main_runtime(&runtime))
+		++device_data->_frame_serial;
+}
+
+}
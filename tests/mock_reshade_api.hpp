@@ -0,0 +1,398 @@
+#pragma once
+
+// Recording stand-ins for the ReShade API objects the core talks to. Nothing is rendered: every
+// command is logged together with the state the resources are in, so tests can check the barriers,
+// copies, draws and allocations of a call, and the benchmark can count them.
+
+#include "reshade_compat.hpp"
+#include "advancedfx_core.hpp"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace advancedfx_test {
+
+enum class op_e {
+	create_resource,
+	destroy_resource,
+	create_view,
+	destroy_view,
+	create_pipeline,
+	barrier,
+	copy,
+	resolve,
+	draw,
+	render_effects,
+	flush,
+	signal,
+	wait,
+	map,
+	set_effects_state
+};
+
+struct mock_command_queue_s;
+
+struct command_s {
+	op_e op;
+	const mock_command_queue_s* queue; // The queue the command was recorded for, null for device calls.
+	resource source;                   // barrier: the resource, copy / resolve: the source.
+	resource dest;
+	resource_usage old_state;
+	resource_usage new_state;
+	resource_view view;                // draw / render_effects: the target.
+	uint64_t value;                    // signal / wait: the fence value, set_effects_state: the state.
+};
+
+struct counters_s {
+	uint64_t commands = 0;       // Everything recorded on a command list or queue.
+	uint64_t barrier_calls = 0;
+	uint64_t transitions = 0;
+	uint64_t copies = 0;
+	uint64_t resolves = 0;
+	uint64_t draws = 0;
+	uint64_t effect_passes = 0;
+	uint64_t resources_created = 0;
+	uint64_t resources_destroyed = 0;
+	uint64_t views_created = 0;
+	uint64_t views_destroyed = 0;
+	uint64_t pipelines_created = 0;
+	uint64_t maps = 0;
+	uint64_t signals = 0;
+	uint64_t waits = 0;
+	uint64_t effects_state_changes = 0;
+};
+
+counters_s operator-(const counters_s& a, const counters_s& b);
+
+// Keyed by the 16 bytes ReShade uses for private data.
+struct private_data_s {
+	std::map<std::string, uint64_t> _values;
+
+	uint64_t get(const uint8_t key[16]) const;
+	void set(const uint8_t key[16], uint64_t value);
+};
+
+struct mock_device_s : device {
+	struct resource_entry_s {
+		resource_desc desc;
+		resource_usage state;
+		std::vector<uint8_t> memory; // Backs map_texture_region.
+	};
+	struct view_entry_s {
+		resource target;
+		resource_usage usage;
+		resource_view_desc desc;
+	};
+	struct pipeline_entry_s {
+		format target_format;
+		uint32_t samples;
+	};
+
+	// The game and HLAE destroy resources on other threads than the calls run on.
+	mutable std::mutex _mutex;
+	device_api _api;
+	uint64_t _next_handle = 0x1000;
+	std::map<uint64_t, resource_entry_s> _resources;
+	std::map<uint64_t, view_entry_s> _views;
+	std::map<uint64_t, pipeline_entry_s> _pipelines;
+	std::map<uint64_t, uint64_t> _fences; // Value the fence was signaled to.
+	std::vector<command_s> _log;
+	std::vector<std::string> _errors;
+	counters_s _counters;
+	bool _recording = true; // The benchmark only counts.
+	private_data_s _private_data;
+
+	explicit mock_device_s(device_api api) : _api(api) {}
+
+	// Creates a resource the way HLAE / the game would, outside of the addon.
+	resource create_texture(uint32_t width, uint32_t height, format format, uint16_t samples, resource_usage usage, resource_usage initial_state);
+
+	resource_usage get_state(resource resource) const;
+	resource get_view_resource(resource_view view) const;
+	format get_view_format(resource_view view) const;
+	size_t get_resource_count() const;
+	size_t get_view_count() const;
+	size_t get_view_count(resource target) const;
+	counters_s get_counters() const;
+	std::vector<command_s> take_log();
+	std::vector<std::string> take_errors();
+
+	// Used by the mock command lists and queues, expects _mutex to be held.
+	void record(const command_s& command);
+	void error(const std::string& message);
+	bool allows(resource resource, resource_usage usage);
+	uint64_t next_handle() { return _next_handle++; }
+
+	uint64_t get_native() const override { return 0; }
+	void get_private_data(const uint8_t key[16], uint64_t* value) const override;
+	void set_private_data(const uint8_t key[16], const uint64_t value) override;
+
+	device_api get_api() const override { return _api; }
+	bool check_capability(device_caps) const override { return true; }
+	bool check_format_support(format, resource_usage) const override { return true; }
+	bool create_sampler(const sampler_desc& desc, sampler* out_sampler) override;
+	void destroy_sampler(sampler) override {}
+	bool create_resource(const resource_desc& desc, const subresource_data* initial_data, resource_usage initial_state, resource* out_resource, void** shared_handle = nullptr) override;
+	void destroy_resource(resource resource) override;
+	resource_desc get_resource_desc(resource resource) const override;
+	bool create_resource_view(resource resource, resource_usage usage_type, const resource_view_desc& desc, resource_view* out_view) override;
+	void destroy_resource_view(resource_view view) override;
+	resource get_resource_from_view(resource_view view) const override { return get_view_resource(view); }
+	resource_view_desc get_resource_view_desc(resource_view view) const override;
+	uint64_t get_resource_view_gpu_address(resource_view) const override { return 0; }
+	bool map_buffer_region(resource, uint64_t, uint64_t, map_access, void**) override { return false; }
+	void unmap_buffer_region(resource) override {}
+	bool map_texture_region(resource resource, uint32_t subresource, const subresource_box* box, map_access access, subresource_data* out_data) override;
+	void unmap_texture_region(resource, uint32_t) override {}
+	void update_buffer_region(const void*, resource, uint64_t, uint64_t) override {}
+	void update_texture_region(const subresource_data&, resource, uint32_t, const subresource_box* = nullptr) override {}
+	bool create_pipeline(pipeline_layout layout, uint32_t subobject_count, const pipeline_subobject* subobjects, pipeline* out_pipeline) override;
+	void destroy_pipeline(pipeline pipeline) override;
+	bool create_pipeline_layout(uint32_t param_count, const pipeline_layout_param* params, pipeline_layout* out_layout) override;
+	void destroy_pipeline_layout(pipeline_layout) override {}
+	bool allocate_descriptor_tables(uint32_t, pipeline_layout, uint32_t, descriptor_table*) override { return false; }
+	void free_descriptor_tables(uint32_t, const descriptor_table*) override {}
+	void get_descriptor_heap_offset(descriptor_table, uint32_t, uint32_t, descriptor_heap*, uint32_t*) const override {}
+	void copy_descriptor_tables(uint32_t, const descriptor_table_copy*) override {}
+	void update_descriptor_tables(uint32_t, const descriptor_table_update*) override {}
+	bool create_query_heap(query_type, uint32_t, query_heap* out_heap) override;
+	void destroy_query_heap(query_heap) override {}
+	bool get_query_heap_results(query_heap, uint32_t, uint32_t, void*, uint32_t) override { return false; }
+	void set_resource_name(resource, const char*) override {}
+	void set_resource_view_name(resource_view, const char*) override {}
+	bool create_fence(uint64_t initial_value, fence_flags flags, fence* out_fence, void** shared_handle = nullptr) override;
+	void destroy_fence(fence fence) override;
+	uint64_t get_completed_fence_value(fence fence) const override;
+	bool wait(fence fence, uint64_t value, uint64_t timeout = UINT64_MAX) override;
+	bool signal(fence fence, uint64_t value) override;
+	void get_acceleration_structure_size(acceleration_structure_type, acceleration_structure_build_flags, uint32_t, const acceleration_structure_build_input*, uint64_t*, uint64_t*, uint64_t*) const override {}
+	bool get_pipeline_shader_group_handles(pipeline, uint32_t, uint32_t, void*) override { return false; }
+};
+
+struct mock_command_list_s : command_list {
+	mock_device_s* _device;
+	mock_command_queue_s* _queue;
+	private_data_s _private_data;
+	pipeline _pipeline = { 0 };
+	resource_view _target = { 0 };
+	std::vector<resource_view> _shader_resources;
+
+	mock_command_list_s(mock_device_s* device, mock_command_queue_s* queue) : _device(device), _queue(queue) {}
+
+	uint64_t get_native() const override { return 0; }
+	void get_private_data(const uint8_t key[16], uint64_t* value) const override { *value = _private_data.get(key); }
+	void set_private_data(const uint8_t key[16], const uint64_t value) override { _private_data.set(key, value); }
+	device* get_device() override { return _device; }
+
+	void barrier(uint32_t count, const resource* resources, const resource_usage* old_states, const resource_usage* new_states) override;
+	void begin_render_pass(uint32_t, const render_pass_render_target_desc*, const render_pass_depth_stencil_desc* = nullptr) override {}
+	void end_render_pass() override {}
+	void bind_render_targets_and_depth_stencil(uint32_t count, const resource_view* rtvs, resource_view dsv = { 0 }) override;
+	void bind_pipeline(pipeline_stage stages, pipeline pipeline) override;
+	void bind_pipeline_states(uint32_t, const dynamic_state*, const uint32_t*) override {}
+	void bind_viewports(uint32_t, uint32_t, const viewport*) override {}
+	void bind_scissor_rects(uint32_t, uint32_t, const rect*) override {}
+	void push_constants(shader_stage, pipeline_layout, uint32_t, uint32_t, uint32_t, const void*) override {}
+	void push_descriptors(shader_stage stages, pipeline_layout layout, uint32_t layout_param, const descriptor_table_update& update) override;
+	void bind_descriptor_tables(shader_stage, pipeline_layout, uint32_t, uint32_t, const descriptor_table*) override {}
+	void bind_index_buffer(resource, uint64_t, uint32_t) override {}
+	void bind_vertex_buffers(uint32_t, uint32_t, const resource*, const uint64_t*, const uint32_t*) override {}
+	void bind_stream_output_buffers(uint32_t, uint32_t, const resource*, const uint64_t*, const uint64_t*, const resource*, const uint64_t*) override {}
+	void draw(uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance) override;
+	void draw_indexed(uint32_t, uint32_t, uint32_t, int32_t, uint32_t) override {}
+	void dispatch(uint32_t, uint32_t, uint32_t) override {}
+	void dispatch_mesh(uint32_t, uint32_t, uint32_t) override {}
+	void dispatch_rays(resource, uint64_t, uint64_t, resource, uint64_t, uint64_t, uint64_t, resource, uint64_t, uint64_t, uint64_t, resource, uint64_t, uint64_t, uint64_t, uint32_t, uint32_t, uint32_t) override {}
+	void draw_or_dispatch_indirect(indirect_command, resource, uint64_t, uint32_t, uint32_t) override {}
+	void copy_resource(resource source, resource dest) override;
+	void copy_buffer_region(resource, uint64_t, resource, uint64_t, uint64_t) override {}
+	void copy_buffer_to_texture(resource, uint64_t, uint32_t, uint32_t, resource, uint32_t, const subresource_box* = nullptr) override {}
+	void copy_texture_region(resource source, uint32_t source_subresource, const subresource_box* source_box, resource dest, uint32_t dest_subresource, const subresource_box* dest_box, filter_mode filter = filter_mode::min_mag_mip_point) override;
+	void copy_texture_to_buffer(resource, uint32_t, const subresource_box*, resource, uint64_t, uint32_t = 0, uint32_t = 0) override {}
+	void resolve_texture_region(resource source, uint32_t source_subresource, const subresource_box* source_box, resource dest, uint32_t dest_subresource, int32_t dest_x, int32_t dest_y, int32_t dest_z, format format) override;
+	void clear_depth_stencil_view(resource_view, const float*, const uint8_t*, uint32_t = 0, const rect* = nullptr) override {}
+	void clear_render_target_view(resource_view, const float[4], uint32_t = 0, const rect* = nullptr) override {}
+	void clear_unordered_access_view_uint(resource_view, const uint32_t[4], uint32_t = 0, const rect* = nullptr) override {}
+	void clear_unordered_access_view_float(resource_view, const float[4], uint32_t = 0, const rect* = nullptr) override {}
+	void generate_mipmaps(resource_view) override {}
+	void begin_query(query_heap, query_type, uint32_t) override {}
+	void end_query(query_heap, query_type, uint32_t) override {}
+	void copy_query_heap_results(query_heap, query_type, uint32_t, uint32_t, resource, uint64_t, uint32_t) override {}
+	void copy_acceleration_structure(resource_view, resource_view, acceleration_structure_copy_mode) override {}
+	void build_acceleration_structure(acceleration_structure_type, acceleration_structure_build_flags, uint32_t, const acceleration_structure_build_input*, resource, uint64_t, resource_view, resource_view, acceleration_structure_build_mode) override {}
+	void query_acceleration_structures(uint32_t, const resource_view*, query_heap, query_type, uint32_t) override {}
+	void begin_debug_event(const char*, const float[4] = nullptr) override {}
+	void end_debug_event() override {}
+	void insert_debug_marker(const char*, const float[4] = nullptr) override {}
+
+	void copy(op_e op, resource source, resource dest);
+};
+
+struct mock_command_queue_s : command_queue {
+	mock_device_s* _device;
+	command_queue_type _type;
+	mock_command_list_s _list;
+	private_data_s _private_data;
+
+	mock_command_queue_s(mock_device_s* device, command_queue_type type) : _device(device), _type(type), _list(device, this) {}
+
+	uint64_t get_native() const override { return 0; }
+	void get_private_data(const uint8_t key[16], uint64_t* value) const override { *value = _private_data.get(key); }
+	void set_private_data(const uint8_t key[16], const uint64_t value) override { _private_data.set(key, value); }
+	device* get_device() override { return _device; }
+
+	command_queue_type get_type() const override { return _type; }
+	void wait_idle() const override {}
+	void flush_immediate_command_list() const override;
+	command_list* get_immediate_command_list() override { return &_list; }
+	void begin_debug_event(const char*, const float[4] = nullptr) override {}
+	void end_debug_event() override {}
+	void insert_debug_marker(const char*, const float[4] = nullptr) override {}
+	bool wait(fence fence, uint64_t value) override;
+	bool signal(fence fence, uint64_t value) override;
+	uint64_t get_timestamp_frequency() const override { return 0; }
+};
+
+struct mock_effect_runtime_s final : effect_runtime {
+	struct technique_s {
+		std::string name;
+		bool enabled;
+	};
+	struct uniform_s {
+		std::string name;
+		std::string source;
+		std::vector<float> values; // Set last.
+	};
+
+	mock_device_s* _device;
+	mock_command_queue_s* _queue;
+	private_data_s _private_data;
+	bool _effects_enabled = true;
+	std::vector<technique_s> _techniques;
+	std::vector<uniform_s> _uniforms;
+	std::map<std::string, resource_view> _bindings;
+	// Semantics whose bound views are checked to be readable when effects render.
+	std::vector<std::string> _checked_bindings;
+	// ReShade recreates the effect resources when the size effects render at changes.
+	uint32_t _width = 0;
+	uint32_t _height = 0;
+	uint32_t _resizes = 0;
+	uint32_t _technique_switches = 0;
+	uint32_t _uniform_writes = 0;
+
+	mock_effect_runtime_s(mock_device_s* device, mock_command_queue_s* queue) : _device(device), _queue(queue) {}
+
+	uint64_t get_native() const override { return 0; }
+	void get_private_data(const uint8_t key[16], uint64_t* value) const override { *value = _private_data.get(key); }
+	void set_private_data(const uint8_t key[16], const uint64_t value) override { _private_data.set(key, value); }
+	device* get_device() override { return _device; }
+
+	void* get_hwnd() const override { return nullptr; }
+	resource get_back_buffer(uint32_t) override { return { 0 }; }
+	uint32_t get_back_buffer_count() const override { return 0; }
+	uint32_t get_current_back_buffer_index() const override { return 0; }
+	bool check_color_space_support(color_space) const override { return false; }
+	bool set_color_space(color_space) override { return false; }
+	color_space get_color_space() const override { return color_space::unknown; }
+
+	command_queue* get_command_queue() override { return _queue; }
+	void render_effects(command_list* cmd_list, resource_view rtv, resource_view rtv_srgb = { 0 }) override;
+	void render_technique(effect_technique, command_list*, resource_view, resource_view = { 0 }) override {}
+	bool capture_screenshot(void*) override { return false; }
+	void get_screenshot_width_and_height(uint32_t*, uint32_t*) const override {}
+	bool is_key_down(uint32_t) const override { return false; }
+	bool is_key_pressed(uint32_t) const override { return false; }
+	bool is_key_released(uint32_t) const override { return false; }
+	bool is_mouse_button_down(uint32_t) const override { return false; }
+	bool is_mouse_button_pressed(uint32_t) const override { return false; }
+	bool is_mouse_button_released(uint32_t) const override { return false; }
+	void get_mouse_cursor_position(uint32_t*, uint32_t*, int16_t* = nullptr) const override {}
+	void enumerate_uniform_variables(const char* effect_name, void(*callback)(effect_runtime* runtime, effect_uniform_variable variable, void* user_data), void* user_data) override;
+	effect_uniform_variable find_uniform_variable(const char*, const char*) const override { return { 0 }; }
+	void get_uniform_variable_type(effect_uniform_variable, format*, uint32_t* = nullptr, uint32_t* = nullptr, uint32_t* = nullptr) const override {}
+	void get_uniform_variable_name(effect_uniform_variable variable, char* name, size_t* name_size) const override;
+	void get_uniform_variable_effect_name(effect_uniform_variable, char*, size_t*) const override {}
+	bool get_annotation_bool_from_uniform_variable(effect_uniform_variable, const char*, bool*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_float_from_uniform_variable(effect_uniform_variable, const char*, float*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_int_from_uniform_variable(effect_uniform_variable, const char*, int32_t*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_uint_from_uniform_variable(effect_uniform_variable, const char*, uint32_t*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_string_from_uniform_variable(effect_uniform_variable variable, const char* name, char* value, size_t* value_size) const override;
+	void reset_uniform_value(effect_uniform_variable) override {}
+	void get_uniform_value_bool(effect_uniform_variable, bool*, size_t, size_t = 0) const override {}
+	void get_uniform_value_float(effect_uniform_variable, float*, size_t, size_t = 0) const override {}
+	void get_uniform_value_int(effect_uniform_variable, int32_t*, size_t, size_t = 0) const override {}
+	void get_uniform_value_uint(effect_uniform_variable, uint32_t*, size_t, size_t = 0) const override {}
+	void set_uniform_value_bool(effect_uniform_variable, const bool*, size_t, size_t = 0) override {}
+	void set_uniform_value_float(effect_uniform_variable variable, const float* values, size_t count, size_t array_index = 0) override;
+	void set_uniform_value_int(effect_uniform_variable, const int32_t*, size_t, size_t = 0) override {}
+	void set_uniform_value_uint(effect_uniform_variable, const uint32_t*, size_t, size_t = 0) override {}
+	void enumerate_texture_variables(const char*, void(*)(effect_runtime*, effect_texture_variable, void*), void*) override {}
+	effect_texture_variable find_texture_variable(const char*, const char*) const override { return { 0 }; }
+	void get_texture_variable_name(effect_texture_variable, char*, size_t*) const override {}
+	void get_texture_variable_effect_name(effect_texture_variable, char*, size_t*) const override {}
+	bool get_annotation_bool_from_texture_variable(effect_texture_variable, const char*, bool*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_float_from_texture_variable(effect_texture_variable, const char*, float*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_int_from_texture_variable(effect_texture_variable, const char*, int32_t*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_uint_from_texture_variable(effect_texture_variable, const char*, uint32_t*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_string_from_texture_variable(effect_texture_variable, const char*, char*, size_t*) const override { return false; }
+	void update_texture(effect_texture_variable, const uint32_t, const uint32_t, const void*) override {}
+	void get_texture_binding(effect_texture_variable, resource_view*, resource_view* = nullptr) const override {}
+	void update_texture_bindings(const char* semantic, resource_view srv, resource_view srv_srgb = { 0 }) override;
+	void enumerate_techniques(const char* effect_name, void(*callback)(effect_runtime* runtime, effect_technique technique, void* user_data), void* user_data) override;
+	effect_technique find_technique(const char*, const char*) override { return { 0 }; }
+	void get_technique_name(effect_technique technique, char* name, size_t* name_size) const override;
+	void get_technique_effect_name(effect_technique, char*, size_t*) const override {}
+	bool get_annotation_bool_from_technique(effect_technique, const char*, bool*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_float_from_technique(effect_technique, const char*, float*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_int_from_technique(effect_technique, const char*, int32_t*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_uint_from_technique(effect_technique, const char*, uint32_t*, size_t, size_t = 0) const override { return false; }
+	bool get_annotation_string_from_technique(effect_technique, const char*, char*, size_t*) const override { return false; }
+	bool get_technique_state(effect_technique technique) const override;
+	void set_technique_state(effect_technique technique, bool enabled) override;
+	bool get_preprocessor_definition(const char*, char*, size_t*) const override { return false; }
+	void set_preprocessor_definition(const char*, const char*) override {}
+	void set_effects_state(bool enabled) override;
+	bool get_effects_state() const override { return _effects_enabled; }
+	void get_current_preset_path(char*, size_t*) const override {}
+	void set_current_preset_path(const char*) override {}
+	void reorder_techniques(size_t, const effect_technique*) override {}
+	void open_overlay(bool, input_source) override {}
+	void reload_effect_next_frame(const char*) override {}
+	bool get_preprocessor_definition_for_effect(const char*, const char*, char*, size_t*) const override { return false; }
+	void set_preprocessor_definition_for_effect(const char*, const char*, const char*) override {}
+	void block_input_next_frame() override {}
+	uint32_t last_key_pressed() const override { return 0; }
+	uint32_t last_key_released() const override { return 0; }
+};
+
+// A device with a graphics queue and the main effect runtime, set up like on_init_device and
+// on_init_effect_runtime do.
+struct mock_setup_s {
+	mock_device_s device;
+	mock_command_queue_s queue;
+	mock_effect_runtime_s runtime;
+	device_data_s* device_data;
+	runtime_data_s* runtime_data;
+	runtime_registry_s runtimes; // runtime is the main runtime.
+
+	explicit mock_setup_s(device_api api);
+	~mock_setup_s();
+
+	// Same as AdvancedfxRenderEffects(Keyed / Masked).
+	bool render_effects(resource back_buffer_resource, resource depth_buffer_resource, uint64_t content_key = 0,
+		bool use_technique_mask = false, uint64_t technique_mask = 0);
+	// Same as AdvancedfxBindEffectRuntime.
+	bool bind_effect_runtime(resource back_buffer_resource, effect_runtime* stream_runtime);
+	// Same as AdvancedfxSetRenderScale.
+	bool set_render_scale(resource back_buffer_resource, uint32_t scale);
+	// Same as AdvancedfxSetRenderRect.
+	bool set_render_rect(resource back_buffer_resource, rect crop);
+	// Same as the destroy_resource event followed by the game's destroy.
+	void destroy_resource(resource resource);
+	// Same as the main runtime's reshade_present event.
+	void present();
+};
+
+}
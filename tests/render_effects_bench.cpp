@@ -0,0 +1,75 @@
+#include "mock_reshade_api.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace advancedfx_test;
+
+// Measures the CPU cost of a render call on the mock backend, which records nothing here, and
+// counts the commands, barriers and allocations it makes per call after the first one.
+
+namespace {
+
+	struct bench_case_s {
+		const char* name;
+		format target_format;
+		uint16_t target_samples;
+		bool has_depth;
+		uint16_t depth_samples;
+		bool direct_depth_binding;
+	};
+
+	const bench_case_s bench_cases[] = {
+		{ "rgba8", format::r8g8b8a8_unorm, 1, false, 1, true },
+		{ "rgba8 depth", format::r8g8b8a8_unorm, 1, true, 1, true },
+		{ "rgba8 depth copy", format::r8g8b8a8_unorm, 1, true, 1, false },
+		{ "bgrx8 conversion", format::b8g8r8x8_unorm, 1, false, 1, true },
+		{ "bgrx8 conversion depth", format::b8g8r8x8_unorm, 1, true, 1, true },
+		{ "rgba8 msaa4x", format::r8g8b8a8_unorm, 4, false, 1, true },
+		{ "rgba8 msaa4x depth msaa4x", format::r8g8b8a8_unorm, 4, true, 4, true }
+	};
+
+	void run_case(const bench_case_s& bench_case, uint32_t iterations) {
+		mock_setup_s setup(device_api::d3d11);
+		setup.device._recording = false;
+		setup.device_data->_direct_depth_binding = bench_case.direct_depth_binding;
+
+		const bool in_place = bench_case.target_samples == 1 && bench_case.target_format != format::b8g8r8x8_unorm;
+		const resource_usage target_usage = resource_usage::render_target | resource_usage::shader_resource | resource_usage::copy_source | resource_usage::copy_dest | resource_usage::resolve_source;
+		const resource target = setup.device.create_texture(1920, 1080, bench_case.target_format, bench_case.target_samples, target_usage, in_place ? target_usage : resource_usage::present);
+		const resource depth = bench_case.has_depth
+			? setup.device.create_texture(1920, 1080, format::r32_typeless, bench_case.depth_samples, resource_usage::depth_stencil | resource_usage::shader_resource | resource_usage::copy_source, resource_usage::depth_stencil)
+			: resource{ 0 };
+
+		// The first call creates the resources, it is not measured.
+		setup.render_effects(target, depth);
+
+		const counters_s before = setup.device.get_counters();
+		const auto start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < iterations; ++i)
+			setup.render_effects(target, depth);
+		const auto end = std::chrono::steady_clock::now();
+		const counters_s delta = setup.device.get_counters() - before;
+
+		const double ns_per_call = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+		std::printf("%-28s %10.0f %10.2f %10.2f %10.2f %10.2f %8zu\n", bench_case.name, ns_per_call,
+			static_cast<double>(delta.commands) / iterations,
+			static_cast<double>(delta.barrier_calls) / iterations,
+			static_cast<double>(delta.transitions) / iterations,
+			static_cast<double>(delta.resources_created + delta.views_created) / iterations,
+			setup.device.take_errors().size());
+	}
+}
+
+int main(int argc, char* argv[]) {
+	const uint32_t iterations = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 20000;
+	if (iterations == 0)
+		return 1;
+
+	std::printf("%u calls per case\n", iterations);
+	std::printf("%-28s %10s %10s %10s %10s %10s %8s\n", "case", "ns/call", "cmds/call", "barriers", "transitions", "allocs", "errors");
+	for (const auto& bench_case : bench_cases)
+		run_case(bench_case, iterations);
+	return 0;
+}
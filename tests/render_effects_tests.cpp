@@ -0,0 +1,478 @@
+#include "mock_reshade_api.hpp"
+#include "test_harness.hpp"
+
+#include <algorithm>
+
+using namespace advancedfx_test;
+
+namespace {
+
+	// States HLAE passes its resources in, see render_effects_pass.
+	const resource_usage target_usage = resource_usage::render_target | resource_usage::shader_resource | resource_usage::copy_source | resource_usage::copy_dest;
+	const resource_usage msaa_target_usage = resource_usage::render_target | resource_usage::resolve_source | resource_usage::copy_source;
+	const resource_usage depth_usage = resource_usage::depth_stencil | resource_usage::shader_resource | resource_usage::copy_source;
+
+	resource create_target(mock_setup_s& setup, format format, uint16_t samples = 1) {
+		const bool in_place = samples == 1 && format != format::r8g8b8x8_unorm && format != format::b8g8r8x8_unorm;
+		const resource_usage usage = samples > 1 ? msaa_target_usage : target_usage;
+		return setup.device.create_texture(1280, 720, format, samples, usage, in_place ? usage : resource_usage::present);
+	}
+
+	resource create_depth(mock_setup_s& setup, uint16_t samples = 1) {
+		return setup.device.create_texture(1280, 720, format::r32_typeless, samples, depth_usage, resource_usage::depth_stencil);
+	}
+
+	size_t count_ops(const std::vector<command_s>& log, op_e op) {
+		return static_cast<size_t>(std::count_if(log.begin(), log.end(), [op](const command_s& command) { return command.op == op; }));
+	}
+
+	const command_s* find_op(const std::vector<command_s>& log, op_e op) {
+		for (const auto& command : log) {
+			if (command.op == op)
+				return &command;
+		}
+		return nullptr;
+	}
+
+	// HLAE's resources have to be handed back in the state they came in.
+	void check_handed_back(mock_setup_s& setup, resource target, resource depth, resource_usage target_state) {
+		CHECK(setup.device.get_state(target) == target_state);
+		if (depth != 0)
+			CHECK(setup.device.get_state(depth) == resource_usage::depth_stencil);
+	}
+
+	void check_no_errors(mock_setup_s& setup) {
+		const auto errors = setup.device.take_errors();
+		for (const auto& error : errors)
+			std::fprintf(stderr, "mock: %s\n", error.c_str());
+		CHECK(errors.empty());
+	}
+
+	// A second call on the same resources has to get by without creating anything.
+	void check_no_allocations(mock_setup_s& setup, resource target, resource depth) {
+		const counters_s before = setup.device.get_counters();
+		CHECK(setup.render_effects(target, depth));
+		const counters_s delta = setup.device.get_counters() - before;
+		CHECK(delta.resources_created == 0);
+		CHECK(delta.views_created == 0);
+		CHECK(delta.pipelines_created == 0);
+		check_no_errors(setup);
+	}
+}
+
+TEST_CASE(renders_in_place_without_msaa) {
+	mock_setup_s setup(device_api::d3d11);
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+	setup.device.take_log();
+
+	CHECK(setup.render_effects(target, { 0 }));
+	const auto log = setup.device.take_log();
+	check_no_errors(setup);
+
+	// No resolve texture, the effects render straight into the target and nothing is copied back.
+	CHECK(count_ops(log, op_e::render_effects) == 1);
+	CHECK(count_ops(log, op_e::copy) == 0);
+	CHECK(count_ops(log, op_e::resolve) == 0);
+	CHECK(count_ops(log, op_e::draw) == 0);
+	CHECK(count_ops(log, op_e::create_resource) == 0);
+	const auto effects = find_op(log, op_e::render_effects);
+	CHECK(effects != nullptr && effects->dest == target);
+	check_handed_back(setup, target, { 0 }, target_usage);
+
+	check_no_allocations(setup, target, { 0 });
+}
+
+TEST_CASE(converts_x8_format_through_resolve_texture) {
+	mock_setup_s setup(device_api::d3d11);
+	const resource target = create_target(setup, format::b8g8r8x8_unorm);
+	setup.device.take_log();
+
+	CHECK(setup.render_effects(target, { 0 }));
+	const auto log = setup.device.take_log();
+	check_no_errors(setup);
+
+	// Copied into a B8G8R8A8 texture, effects run there and the result is drawn back.
+	const auto copy = find_op(log, op_e::copy);
+	const auto effects = find_op(log, op_e::render_effects);
+	CHECK(copy != nullptr && copy->source == target);
+	CHECK(effects != nullptr && effects->dest != target && copy != nullptr && effects->dest == copy->dest);
+	CHECK(effects != nullptr && setup.device.get_view_format(effects->view) == format::b8g8r8a8_unorm);
+	CHECK(count_ops(log, op_e::draw) == 1);
+	const auto draw = find_op(log, op_e::draw);
+	CHECK(draw != nullptr && draw->dest == target && draw > effects);
+	// The write-back pipeline has to match the X8 view it draws into, the mock checks the draw.
+	CHECK(draw != nullptr && setup.device.get_view_format(draw->view) == format::b8g8r8x8_unorm);
+	check_handed_back(setup, target, { 0 }, resource_usage::present);
+
+	check_no_allocations(setup, target, { 0 });
+}
+
+TEST_CASE(renders_x8_format_in_place_on_vulkan) {
+	mock_setup_s setup(device_api::vulkan);
+	const resource target = setup.device.create_texture(1280, 720, format::b8g8r8x8_unorm, 1, target_usage, target_usage);
+	setup.device.take_log();
+
+	CHECK(setup.render_effects(target, { 0 }));
+	const auto log = setup.device.take_log();
+	check_no_errors(setup);
+
+	// Vulkan can view the target as B8G8R8A8, no resolve texture or write-back needed.
+	const auto effects = find_op(log, op_e::render_effects);
+	CHECK(effects != nullptr && effects->dest == target);
+	CHECK(effects != nullptr && setup.device.get_view_format(effects->view) == format::b8g8r8a8_unorm);
+	CHECK(count_ops(log, op_e::copy) == 0);
+	CHECK(count_ops(log, op_e::create_resource) == 0);
+	check_handed_back(setup, target, { 0 }, target_usage);
+}
+
+TEST_CASE(resolves_msaa_target) {
+	mock_setup_s setup(device_api::d3d11);
+	const resource target = create_target(setup, format::r8g8b8a8_unorm, 4);
+	setup.device.take_log();
+
+	CHECK(setup.render_effects(target, { 0 }));
+	const auto log = setup.device.take_log();
+	check_no_errors(setup);
+
+	const auto resolve = find_op(log, op_e::resolve);
+	const auto effects = find_op(log, op_e::render_effects);
+	const auto draw = find_op(log, op_e::draw);
+	CHECK(resolve != nullptr && resolve->source == target);
+	CHECK(count_ops(log, op_e::copy) == 0);
+	CHECK(effects != nullptr && resolve != nullptr && effects->dest == resolve->dest);
+	CHECK(draw != nullptr && draw->dest == target && draw > effects);
+	check_handed_back(setup, target, { 0 }, resource_usage::present);
+
+	check_no_allocations(setup, target, { 0 });
+}
+
+TEST_CASE(binds_depth_directly) {
+	mock_setup_s setup(device_api::d3d11);
+	setup.runtime._checked_bindings = { "DEPTH" };
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+	const resource depth = create_depth(setup);
+	setup.device.take_log();
+
+	CHECK(setup.render_effects(target, depth));
+	const auto log = setup.device.take_log();
+	check_no_errors(setup);
+
+	// A typeless depth buffer HLAE allows reading from is sampled without a copy.
+	CHECK(count_ops(log, op_e::copy) == 0);
+	CHECK(setup.device.get_view_resource(setup.runtime._bindings["DEPTH"]) == depth);
+	check_handed_back(setup, target, depth, target_usage);
+
+	check_no_allocations(setup, target, depth);
+}
+
+TEST_CASE(copies_depth_without_direct_binding) {
+	mock_setup_s setup(device_api::d3d11);
+	setup.device_data->_direct_depth_binding = false;
+	setup.runtime._checked_bindings = { "DEPTH" };
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+	const resource depth = create_depth(setup);
+	setup.device.take_log();
+
+	CHECK(setup.render_effects(target, depth));
+	const auto log = setup.device.take_log();
+	check_no_errors(setup);
+
+	const auto copy = find_op(log, op_e::copy);
+	CHECK(copy != nullptr && copy->source == depth);
+	CHECK(copy != nullptr && setup.device.get_view_resource(setup.runtime._bindings["DEPTH"]) == copy->dest);
+	CHECK(copy != nullptr && copy < find_op(log, op_e::render_effects));
+	check_handed_back(setup, target, depth, target_usage);
+
+	check_no_allocations(setup, target, depth);
+}
+
+TEST_CASE(resolves_msaa_depth) {
+	mock_setup_s setup(device_api::d3d11);
+	setup.runtime._checked_bindings = { "DEPTH" };
+	const resource target = create_target(setup, format::r8g8b8a8_unorm, 4);
+	const resource depth = create_depth(setup, 4);
+	setup.device.take_log();
+
+	CHECK(setup.render_effects(target, depth));
+	const auto log = setup.device.take_log();
+	check_no_errors(setup);
+
+	// Depth resolve draw, then the effects, then the write-back draw.
+	CHECK(count_ops(log, op_e::draw) == 2);
+	const auto depth_resolve = find_op(log, op_e::draw);
+	CHECK(depth_resolve != nullptr && setup.device.get_view_resource(setup.runtime._bindings["DEPTH"]) == depth_resolve->dest);
+	CHECK(depth_resolve != nullptr && depth_resolve < find_op(log, op_e::render_effects));
+	check_handed_back(setup, target, depth, resource_usage::present);
+
+	check_no_allocations(setup, target, depth);
+}
+
+TEST_CASE(unbinds_depth_without_depth_buffer) {
+	mock_setup_s setup(device_api::d3d11);
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+	const resource depth = create_depth(setup);
+
+	CHECK(setup.render_effects(target, depth));
+	CHECK(setup.runtime._bindings["DEPTH"] != 0);
+	CHECK(setup.render_effects(target, { 0 }));
+	check_no_errors(setup);
+	CHECK(setup.device.get_state(depth) == resource_usage::depth_stencil);
+	check_handed_back(setup, target, { 0 }, target_usage);
+}
+
+TEST_CASE(switches_effects_on_for_hlae_calls) {
+	mock_setup_s setup(device_api::d3d11);
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+
+	// The effects key switched them off, HLAE's next call renders them anyway and leaves them on.
+	setup.runtime._effects_enabled = false;
+	CHECK(setup.render_effects(target, { 0 }));
+	const auto log = setup.device.take_log();
+	const auto effects = find_op(log, op_e::render_effects);
+	CHECK(effects != nullptr && effects->value == 1);
+	CHECK(setup.runtime._effects_enabled);
+
+	// A call without a target switches them off until the next one.
+	CHECK(setup.render_effects({ 0 }, { 0 }));
+	CHECK(!setup.runtime._effects_enabled);
+	CHECK(setup.render_effects(target, { 0 }));
+	CHECK(setup.runtime._effects_enabled);
+	check_no_errors(setup);
+}
+
+TEST_CASE(keeps_effects_off_between_calls_in_hlae_only_mode) {
+	mock_setup_s setup(device_api::d3d11);
+	setup.runtime_data->hlae_only = true;
+	setup.runtime_data->set_effects_state(&setup.runtime, false);
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+	setup.device.take_log();
+
+	// On only for the call's own pass, so ReShade's present pass never runs.
+	for (int i = 0; i < 3; ++i) {
+		CHECK(setup.render_effects(target, { 0 }));
+		CHECK(!setup.runtime._effects_enabled);
+		CHECK(setup.runtime_data->block_effects);
+	}
+	const auto log = setup.device.take_log();
+	CHECK(count_ops(log, op_e::render_effects) == 3);
+	for (const auto& command : log) {
+		if (command.op == op_e::render_effects)
+			CHECK(command.value == 1);
+	}
+
+	const counters_s before = setup.device.get_counters();
+	CHECK(setup.render_effects({ 0 }, { 0 }));
+	CHECK((setup.device.get_counters() - before).effects_state_changes == 0);
+	check_no_errors(setup);
+}
+
+TEST_CASE(switches_only_techniques_the_mask_changes) {
+	mock_setup_s setup(device_api::d3d11);
+	setup.runtime._techniques = { { "A", true }, { "B", false }, { "C", true } };
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+
+	CHECK(setup.render_effects(target, { 0 }, 0, true, 0x2));
+	CHECK(!setup.runtime._techniques[0].enabled && setup.runtime._techniques[1].enabled && !setup.runtime._techniques[2].enabled);
+	CHECK(setup.runtime._technique_switches == 3);
+
+	CHECK(setup.render_effects(target, { 0 }, 0, true, 0x2));
+	CHECK(setup.runtime._technique_switches == 3);
+	CHECK(setup.render_effects(target, { 0 }, 0, true, 0x3));
+	CHECK(setup.runtime._technique_switches == 4);
+
+	// An unmasked call puts back what the user enabled.
+	CHECK(setup.render_effects(target, { 0 }));
+	CHECK(setup.runtime._techniques[0].enabled && !setup.runtime._techniques[1].enabled && setup.runtime._techniques[2].enabled);
+	CHECK(setup.runtime._technique_switches == 6);
+	check_no_errors(setup);
+}
+
+TEST_CASE(writes_camera_uniforms_once_per_update) {
+	mock_setup_s setup(device_api::d3d11);
+	setup.runtime._uniforms = { { "Fov", "camera_fov", {} }, { "View", "camera_view", {} } };
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+
+	setup.device_data->_camera.fov = 90.0f;
+	setup.device_data->_camera.view[1] = 2.0f;
+	++setup.device_data->_camera_serial;
+	CHECK(setup.render_effects(target, { 0 }));
+	CHECK(setup.runtime._uniforms[0].values == std::vector<float>{ 90.0f });
+	CHECK(setup.runtime._uniforms[1].values.size() == 16 && setup.runtime._uniforms[1].values[1] == 2.0f);
+	const uint32_t writes = setup.runtime._uniform_writes;
+
+	CHECK(setup.render_effects(target, { 0 }));
+	CHECK(setup.runtime._uniform_writes == writes);
+
+	// Reloaded effects start with their default values.
+	setup.runtime_data->_reload_pending = true;
+	CHECK(setup.render_effects(target, { 0 }));
+	CHECK(setup.runtime._uniform_writes == 2 * writes);
+	check_no_errors(setup);
+}
+
+TEST_CASE(renders_reduced_size_streams_on_their_own_runtime) {
+	mock_setup_s setup(device_api::d3d11);
+	mock_effect_runtime_s preview_runtime(&setup.device, &setup.queue);
+	preview_runtime.create_private_data<runtime_data_s>();
+	setup.runtimes.add(&preview_runtime);
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+	const resource preview = create_target(setup, format::r8g8b8a8_unorm);
+
+	// The main runtime would have to switch between both sizes.
+	CHECK(!setup.set_render_scale(preview, 2));
+	CHECK(setup.bind_effect_runtime(preview, &preview_runtime));
+	CHECK(setup.set_render_scale(preview, 2));
+	CHECK(!setup.bind_effect_runtime(target, &preview_runtime));
+	CHECK(!setup.bind_effect_runtime(preview, nullptr));
+
+	for (int i = 0; i < 3; ++i) {
+		CHECK(setup.render_effects(target, { 0 }));
+		CHECK(setup.render_effects(preview, { 0 }));
+	}
+	CHECK(setup.runtime._width == 1280 && setup.runtime._resizes == 0);
+	CHECK(preview_runtime._width == 640 && preview_runtime._resizes == 0);
+	check_no_errors(setup);
+
+	// Once its runtime is gone the stream falls back to the main runtime, at full size.
+	setup.runtimes.remove(&preview_runtime);
+	preview_runtime.destroy_private_data<runtime_data_s>();
+	CHECK(setup.render_effects(preview, { 0 }));
+	CHECK(setup.device_data->_back_buffers.find(preview)->_scale == 1);
+	CHECK(setup.runtime._width == 1280 && setup.runtime._resizes == 0);
+	check_no_errors(setup);
+}
+
+TEST_CASE(renders_cropped_streams_on_their_own_runtime) {
+	mock_setup_s setup(device_api::d3d11);
+	mock_effect_runtime_s inset_runtime(&setup.device, &setup.queue);
+	inset_runtime.create_private_data<runtime_data_s>();
+	setup.runtimes.add(&inset_runtime);
+	const resource target = create_target(setup, format::r8g8b8a8_unorm);
+	const resource inset = create_target(setup, format::r8g8b8a8_unorm);
+	const resource depth = create_depth(setup);
+	const rect crop = { 100, 100, 420, 280 };
+
+	// Like a render scale, a rect changes the size the runtime renders at.
+	CHECK(!setup.set_render_rect(inset, crop));
+	CHECK(setup.bind_effect_runtime(inset, &inset_runtime));
+	CHECK(setup.set_render_rect(inset, crop));
+	CHECK(!setup.bind_effect_runtime(target, &inset_runtime));
+	CHECK(!setup.bind_effect_runtime(inset, nullptr));
+	CHECK(setup.set_render_rect(target, { 0, 0, 0, 0 }));
+
+	for (int i = 0; i < 3; ++i) {
+		CHECK(setup.render_effects(target, depth));
+		CHECK(setup.render_effects(inset, depth));
+	}
+	CHECK(setup.runtime._width == 1280 && setup.runtime._resizes == 0);
+	CHECK(inset_runtime._width == 320 && inset_runtime._height == 180 && inset_runtime._resizes == 0);
+	check_handed_back(setup, inset, depth, target_usage);
+	check_no_errors(setup);
+
+	// Once its runtime is gone the stream falls back to the main runtime, uncropped.
+	setup.runtimes.remove(&inset_runtime);
+	inset_runtime.destroy_private_data<runtime_data_s>();
+	CHECK(setup.render_effects(inset, depth));
+	CHECK(!setup.device_data->_back_buffers.find(inset)->has_crop());
+	CHECK(setup.runtime._width == 1280 && setup.runtime._resizes == 0);
+	check_no_errors(setup);
+}
+
+TEST_CASE(keyed_cache_matches_render_scale) {
+	mock_setup_s setup(device_api::d3d11);
+	mock_effect_runtime_s preview_runtime(&setup.device, &setup.queue);
+	preview_runtime.create_private_data<runtime_data_s>();
+	setup.runtimes.add(&preview_runtime);
+	// Goes through a resolve texture at either scale, so its processed images match in format.
+	const resource preview = create_target(setup, format::r8g8b8a8_unorm, 4);
+	CHECK(setup.bind_effect_runtime(preview, &preview_runtime));
+	// The cache only serves targets it has seen before, their buffers are set up in an earlier frame.
+	CHECK(setup.render_effects(preview, { 0 }));
+	setup.present();
+
+	CHECK(setup.render_effects(preview, { 0 }, 1));
+	setup.device.take_log();
+
+	// Same key and size at another scale is a different image, the effects have to run.
+	CHECK(setup.set_render_scale(preview, 2));
+	CHECK(setup.render_effects(preview, { 0 }, 1));
+	CHECK(count_ops(setup.device.take_log(), op_e::render_effects) == 1);
+
+	CHECK(setup.set_render_scale(preview, 1));
+	CHECK(setup.render_effects(preview, { 0 }, 1));
+	const auto log = setup.device.take_log();
+	CHECK(count_ops(log, op_e::render_effects) == 0);
+	CHECK(count_ops(log, op_e::copy) == 1);
+	check_handed_back(setup, preview, { 0 }, resource_usage::present);
+	check_no_errors(setup);
+
+	setup.present();
+	setup.runtimes.remove(&preview_runtime);
+	preview_runtime.destroy_private_data<runtime_data_s>();
+}
+
+TEST_CASE(frees_resources_of_destroyed_targets) {
+	mock_setup_s setup(device_api::d3d11);
+	setup.device_data->_direct_depth_binding = false;
+	const resource target = create_target(setup, format::r8g8b8a8_unorm, 4);
+	const resource depth = create_depth(setup);
+	const size_t views_before = setup.device.get_view_count();
+
+	CHECK(setup.render_effects(target, depth));
+	CHECK(setup.device.get_view_count() > views_before);
+
+	// The bindings and the views on the resources go with the destroy events, before the game destroys
+	// them (the mock reports views outliving their resource) and without waiting for HLAE's next call.
+	setup.destroy_resource(target);
+	setup.destroy_resource(depth);
+	CHECK(setup.runtime._bindings["DEPTH"] == 0);
+	check_no_errors(setup);
+
+	// The next call drops the table entries. The views on the addon's textures go once the GPU passed the
+	// fence signaled at the end of it.
+	const resource other = create_target(setup, format::r8g8b8a8_unorm);
+	CHECK(setup.render_effects(other, { 0 }));
+	CHECK(setup.device_data->_back_buffers.find(target) == nullptr);
+	CHECK(setup.device_data->_depth_buffers.find(depth) == nullptr);
+	CHECK(setup.render_effects(other, { 0 }));
+	CHECK(setup.device.get_view_count() == views_before + setup.device.get_view_count(other));
+	check_no_errors(setup);
+}
+
+TEST_CASE(keyed_calls_keep_history_per_stream) {
+	mock_setup_s setup(device_api::d3d11);
+	setup.device_data->_history_frames = 2;
+	const resource targets[2] = { create_target(setup, format::r8g8b8a8_unorm, 4), create_target(setup, format::r8g8b8a8_unorm, 4) };
+	const resource depth = create_depth(setup);
+
+	// Both streams share the key and the depth buffer, but each has to see its own previous frames.
+	resource last_color[2] = {}, last_depth[2] = {};
+	for (int frame = 0; frame < 4; ++frame) {
+		for (int i = 0; i < 2; ++i) {
+			setup.device.take_log();
+			CHECK(setup.render_effects(targets[i], depth, 1));
+			const auto log = setup.device.take_log();
+			const auto effects = find_op(log, op_e::render_effects);
+			CHECK(effects != nullptr);
+			if (effects == nullptr)
+				continue;
+			if (frame > 0) {
+				CHECK(setup.device.get_view_resource(setup.runtime._bindings["COLOR_PREV"]) == last_color[i]);
+				CHECK(setup.device.get_view_resource(setup.runtime._bindings["DEPTH_PREV"]) == last_depth[i]);
+			}
+			last_color[i] = effects->dest;
+			last_depth[i] = setup.device.get_view_resource(setup.runtime._bindings["DEPTH"]);
+		}
+		setup.present();
+	}
+	check_handed_back(setup, targets[0], depth, resource_usage::present);
+	check_no_errors(setup);
+
+	// The runtime keeps the history of the stream rendered last bound until the stream is destroyed.
+	CHECK(setup.runtime._bindings["COLOR_PREV"] != 0);
+	setup.destroy_resource(targets[1]);
+	CHECK(setup.runtime._bindings["COLOR_PREV"] == 0 && setup.runtime._bindings["DEPTH_PREV"] == 0);
+	check_no_errors(setup);
+}
+
+TEST_MAIN()
@@ -0,0 +1,28 @@
+#pragma once
+
+// Lets the ReShade add-on API headers build with compilers other than MSVC, so the core can be tested
+// on any platform: __declspec is dropped and __uuidof gives a 16 byte key unique to each type, which
+// is all the private data of the API objects needs.
+
+#ifndef _MSC_VER
+#include <cstdint>
+
+#ifndef __declspec
+#define __declspec(x)
+#endif
+
+namespace advancedfx_test {
+	template <typename T>
+	struct type_key_s {
+		const void* address;
+		uint64_t padding;
+
+		static const type_key_s value;
+	};
+
+	template <typename T>
+	const type_key_s<T> type_key_s<T>::value = { &type_key_s<T>::value, 0 };
+}
+
+#define __uuidof(type) (advancedfx_test::type_key_s<type>::value)
+#endif
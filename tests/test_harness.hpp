@@ -0,0 +1,75 @@
+#pragma once
+
+// Minimal self registering test cases, so the tests don't need a framework besides the ReShade headers.
+
+#include <cstdio>
+#include <exception>
+#include <string>
+#include <vector>
+
+namespace advancedfx_test {
+
+struct test_case_s {
+	const char* name;
+	void(*function)();
+};
+
+inline std::vector<test_case_s>& get_test_cases() {
+	static std::vector<test_case_s> test_cases;
+	return test_cases;
+}
+
+inline int& get_failure_count() {
+	static int failure_count = 0;
+	return failure_count;
+}
+
+struct test_registration_s {
+	test_registration_s(const char* name, void(*function)()) {
+		get_test_cases().push_back({ name, function });
+	}
+};
+
+inline void report_failure(const char* file, int line, const char* expression) {
+	std::fprintf(stderr, "%s(%d): CHECK(%s) failed\n", file, line, expression);
+	++get_failure_count();
+}
+
+// Runs the test cases whose name contains filter (all if null), returns the process exit code.
+inline int run_tests(const char* filter) {
+	int failed_tests = 0;
+	for (const auto& test_case : get_test_cases()) {
+		if (filter != nullptr && std::string(test_case.name).find(filter) == std::string::npos)
+			continue;
+		const int failures_before = get_failure_count();
+		try {
+			test_case.function();
+		}
+		catch (const std::exception& e) {
+			std::fprintf(stderr, "%s: exception: %s\n", test_case.name, e.what());
+			++get_failure_count();
+		}
+		const bool passed = get_failure_count() == failures_before;
+		std::printf("[%s] %s\n", passed ? "PASS" : "FAIL", test_case.name);
+		if (!passed)
+			++failed_tests;
+	}
+	std::printf("%d test(s) failed\n", failed_tests);
+	return failed_tests == 0 ? 0 : 1;
+}
+
+}
+
+#define ADVANCEDFX_TEST_CONCAT2(a, b) a##b
+#define ADVANCEDFX_TEST_CONCAT(a, b) ADVANCEDFX_TEST_CONCAT2(a, b)
+
+#define TEST_CASE(name) \
+	static void name(); \
+	static advancedfx_test::test_registration_s ADVANCEDFX_TEST_CONCAT(name, _registration)(#name, &name); \
+	static void name()
+
+#define CHECK(expression) \
+	do { if (!(expression)) advancedfx_test::report_failure(__FILE__, __LINE__, #expression); } while (false)
+
+#define TEST_MAIN() \
+	int main(int argc, char* argv[]) { return advancedfx_test::run_tests(argc > 1 ? argv[1] : nullptr); }
@@ -0,0 +1,59 @@
+#include "mock_reshade_api.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace advancedfx_test;
+
+// Replays a trace written by AdvancedfxStartTrace on the mock backend and reports the CPU time of the
+// calls against the captured one, the texture pool use and anything the mock saw used in a wrong state.
+// trace_replay <trace file> [d3d11|d3d12|vulkan] [-v]
+
+namespace {
+
+	void on_call(void*, uint32_t call, uint64_t captured_cpu_time_ns, uint64_t cpu_time_ns) {
+		std::printf("%8u %12llu %12llu\n", call, static_cast<unsigned long long>(captured_cpu_time_ns), static_cast<unsigned long long>(cpu_time_ns));
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: trace_replay <trace file> [d3d11|d3d12|vulkan] [-v]\n");
+		return 2;
+	}
+
+	device_api api = device_api::d3d11;
+	bool verbose = false;
+	for (int i = 2; i < argc; ++i) {
+		if (std::strcmp(argv[i], "d3d12") == 0)
+			api = device_api::d3d12;
+		else if (std::strcmp(argv[i], "vulkan") == 0)
+			api = device_api::vulkan;
+		else if (std::strcmp(argv[i], "-v") == 0)
+			verbose = true;
+	}
+
+	mock_setup_s setup(api);
+	setup.device._recording = false;
+
+	if (verbose)
+		std::printf("%8s %12s %12s\n", "call", "captured ns", "replay ns");
+	replay_stats_s stats;
+	const bool result = replay_trace(&setup.device, &setup.runtime, argv[1], &stats, verbose ? on_call : nullptr, nullptr);
+	if (!result)
+		std::fprintf(stderr, "%s: not a trace of this version or truncated\n", argv[1]);
+
+	const counters_s counters = setup.device.get_counters();
+	std::printf("calls             %u\n", stats.calls);
+	std::printf("captured cpu ns   %llu\n", static_cast<unsigned long long>(stats.captured_cpu_time_ns));
+	std::printf("replay cpu ns     %llu (max %llu per call)\n", static_cast<unsigned long long>(stats.cpu_time_ns), static_cast<unsigned long long>(stats.max_call_cpu_time_ns));
+	std::printf("textures created  %llu reused %llu evicted %llu\n", static_cast<unsigned long long>(stats.textures_created),
+		static_cast<unsigned long long>(stats.textures_reused), static_cast<unsigned long long>(stats.textures_evicted));
+	std::printf("readback maps     %llu\n", static_cast<unsigned long long>(stats.maps));
+	std::printf("commands          %llu (%llu barriers)\n", static_cast<unsigned long long>(counters.commands), static_cast<unsigned long long>(counters.barrier_calls));
+
+	const auto errors = setup.device.take_errors();
+	for (const auto& error : errors)
+		std::fprintf(stderr, "mock: %s\n", error.c_str());
+	return result && errors.empty() ? 0 : 1;
+}
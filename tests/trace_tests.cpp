@@ -0,0 +1,196 @@
+#include "mock_reshade_api.hpp"
+#include "test_harness.hpp"
+
+#include <thread>
+
+using namespace advancedfx_test;
+
+namespace {
+
+	const char* const trace_path = "trace_tests.afxt";
+
+	const resource_usage target_usage = resource_usage::render_target | resource_usage::shader_resource | resource_usage::copy_source | resource_usage::copy_dest;
+	const resource_usage msaa_target_usage = resource_usage::render_target | resource_usage::resolve_source | resource_usage::copy_source;
+	const resource_usage depth_usage = resource_usage::depth_stencil | resource_usage::shader_resource | resource_usage::copy_source;
+
+	struct record_s {
+		uint8_t type;
+		uint64_t time;
+		std::vector<uint32_t> values; // render: id, state, depth id per entry, the duration is skipped.
+	};
+
+	// Reads what was written to the file so far, false if it ends inside a record.
+	bool read_trace(std::vector<record_s>& records) {
+		trace_reader_s reader;
+		if (!reader.open(trace_path))
+			return false;
+
+		records.clear();
+		record_s record;
+		while (reader.get(record.type) && reader.get(record.time)) {
+			record.values.clear();
+			uint32_t value = 0;
+			uint16_t short_value = 0;
+			uint64_t duration = 0;
+			bool result = true;
+			switch (record.type) {
+			case trace_format_s::record_resource:
+				for (int i = 0; i < 6 && result; ++i) {
+					if (i == 3 || i == 5) {
+						result = reader.get(short_value);
+						record.values.push_back(short_value);
+					}
+					else {
+						result = reader.get(value);
+						record.values.push_back(value);
+					}
+				}
+				result = result && reader.get(value);
+				record.values.push_back(value);
+				break;
+			case trace_format_s::record_render: {
+				uint32_t count = 0;
+				result = reader.get(count);
+				for (uint32_t i = 0; result && i < 3 * count; ++i) {
+					result = reader.get(value);
+					record.values.push_back(value);
+				}
+				result = result && reader.get(duration);
+				break;
+			}
+			case trace_format_s::record_destroy:
+				result = reader.get(value);
+				record.values.push_back(value);
+				break;
+			case trace_format_s::record_readback:
+				for (int i = 0; i < 2 && result; ++i) {
+					result = reader.get(value);
+					record.values.push_back(value);
+				}
+				break;
+			default:
+				return false;
+			}
+			if (!result)
+				return false;
+			records.push_back(record);
+		}
+		return true;
+	}
+
+	size_t count_records(const std::vector<record_s>& records, uint8_t type) {
+		size_t count = 0;
+		for (const auto& record : records)
+			count += record.type == type ? 1 : 0;
+		return count;
+	}
+
+	void check_no_errors(mock_setup_s& setup) {
+		const auto errors = setup.device.take_errors();
+		for (const auto& error : errors)
+			std::fprintf(stderr, "mock: %s\n", error.c_str());
+		CHECK(errors.empty());
+	}
+
+	void on_readback(void*, uint64_t, const void*, uint32_t, uint32_t, uint32_t, uint32_t) {}
+
+	// Renders an in-place, an X8 and an MSAA target with depth for a few frames, one of them with a
+	// readback set before its first call, and destroys the X8 target in between.
+	void write_trace(mock_setup_s& setup, std::vector<record_s>& records_after_frame, uint64_t& destroy_event_time) {
+		const resource in_place = setup.device.create_texture(640, 360, format::r8g8b8a8_unorm, 1, target_usage, target_usage);
+		const resource x8 = setup.device.create_texture(640, 360, format::b8g8r8x8_unorm, 1, target_usage, resource_usage::present);
+		const resource msaa = setup.device.create_texture(640, 360, format::r8g8b8a8_unorm, 4, msaa_target_usage, resource_usage::present);
+		const resource depth = setup.device.create_texture(640, 360, format::r32_typeless, 1, depth_usage, resource_usage::depth_stencil);
+		const resource msaa_depth = setup.device.create_texture(640, 360, format::r32_typeless, 4, depth_usage, resource_usage::depth_stencil);
+
+		CHECK(setup.device_data->_trace.start(trace_path));
+
+		setup.device_data->_trace.write_readback(&setup.device, in_place, 2);
+		CHECK(setup.device_data->set_readback(&setup.device, in_place, on_readback, nullptr, 2));
+
+		for (int frame = 0; frame < 3; ++frame) {
+			CHECK(setup.render_effects(in_place, depth));
+			if (frame < 2)
+				CHECK(setup.render_effects(x8, depth));
+			CHECK(setup.render_effects(msaa, msaa_depth));
+
+			if (frame == 1) {
+				setup.destroy_resource(x8);
+				destroy_event_time = setup.device_data->_trace.now();
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+
+			setup.present();
+		}
+		// The first HLAE call after the main runtime's present flushes the records of the frame to the file.
+		{ hlae_call_s call(setup.runtimes); }
+
+		CHECK(read_trace(records_after_frame));
+
+		setup.device_data->_trace.stop();
+		check_no_errors(setup);
+	}
+}
+
+TEST_CASE(traces_states_and_destroy_times) {
+	std::vector<record_s> records;
+	uint64_t destroy_event_time = 0;
+	{
+		mock_setup_s setup(device_api::d3d11);
+		write_trace(setup, records, destroy_event_time);
+	}
+
+	// Everything up to the last frame boundary is on disk before the trace is stopped.
+	CHECK(count_records(records, trace_format_s::record_render) == 8);
+	CHECK(count_records(records, trace_format_s::record_destroy) == 1);
+	CHECK(count_records(records, trace_format_s::record_readback) == 1);
+
+	// Ids are given in order of first use: the in-place target (readback), depth, X8, MSAA target, MSAA depth.
+	const resource_usage expected_states[] = { target_usage, resource_usage::undefined, resource_usage::present, resource_usage::present, resource_usage::undefined };
+	for (const auto& record : records) {
+		if (record.type == trace_format_s::record_render) {
+			CHECK(record.values.size() == 3);
+			if (record.values.size() == 3 && record.values[0] >= 1 && record.values[0] <= 5)
+				CHECK(static_cast<resource_usage>(record.values[1]) == expected_states[record.values[0] - 1]);
+		}
+		if (record.type == trace_format_s::record_destroy) {
+			CHECK(record.values[0] == 3);
+			// The time the game destroyed it, not the time of the next HLAE call.
+			CHECK(record.time <= destroy_event_time);
+		}
+	}
+}
+
+TEST_CASE(replays_trace_on_mock_device) {
+	std::vector<record_s> records;
+	uint64_t destroy_event_time = 0;
+	{
+		mock_setup_s setup(device_api::d3d11);
+		write_trace(setup, records, destroy_event_time);
+	}
+
+	mock_setup_s setup(device_api::d3d11);
+	replay_stats_s stats;
+	CHECK(replay_trace(&setup.device, &setup.runtime, trace_path, &stats, nullptr, nullptr));
+	CHECK(stats.calls == 8);
+	CHECK(stats.maps > 0);
+	// Replayed targets are created in the state they were handed in, so the mock sees no wrong barriers.
+	check_no_errors(setup);
+	CHECK(setup.device.get_counters().effect_passes == 8);
+}
+
+TEST_CASE(rejects_traces_of_other_versions) {
+	std::FILE* file = std::fopen(trace_path, "wb");
+	CHECK(file != nullptr);
+	if (file == nullptr)
+		return;
+	const uint32_t header[2] = { trace_format_s::magic, 1 };
+	std::fwrite(header, sizeof(header), 1, file);
+	std::fclose(file);
+
+	mock_setup_s setup(device_api::d3d11);
+	replay_stats_s stats;
+	CHECK(!replay_trace(&setup.device, &setup.runtime, trace_path, &stats, nullptr, nullptr));
+}
+
+TEST_MAIN()